@@ -0,0 +1,465 @@
+#include <ecto/ecto.hpp>
+#include <GL/glew.h>
+
+#include "ecto_gl.hpp"
+#include "cloud.hpp"
+#include "cloud_gl.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <opencv2/core/core.hpp>
+
+namespace ecto_gl
+{
+  using ecto::tendrils;
+
+  /** A cloud unprojected from a depth frame, with the frame's depth for matching. */
+  struct DepthCloud
+  {
+    DepthDataConstPtr depth;
+    PointsDataConstPtr points;
+    RgbDataConstPtr colors;
+  };
+
+  /**
+   * What CloudProgram computes, on the CPU: x, y, z in meters for every depth
+   * pixel in image order, NaN where there is no depth, and the RGB of the
+   * color pixel each point projects to in the color camera, black where
+   * there is no depth.
+   * Flying pixels count as no depth for max_jump above 0.
+   * Returns false, leaving points and colors alone, for a frame smaller than
+   * its declared size.
+   */
+  bool
+  depthToCloud(const CloudFrame& f, PointsData& points, RgbData& colors, float max_jump = 0)
+  {
+    int w = f.depth_width, h = f.depth_height;
+    if (depthSamples(f) < size_t(w * h) || !f.rgb
+        || f.rgb->size() < size_t(f.image_width * f.image_height * f.image_channels))
+      return false;
+    points.resize(3 * w * h);
+    colors.resize(3 * w * h);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const Eigen::Vector4f& K = f.depth_K;
+    const Eigen::Vector4f& C = f.image_K;
+    const uint16_t* depth = f.depth->data();
+    std::vector<uint16_t> millimeters;
+    if (f.depth_format != DEPTH_MILLIMETERS)
+    {
+      //as the GPU holds it.
+      millimeters.resize(w * h);
+      for (int i = 0; i < w * h; i++)
+        millimeters[i] = depthMillimeters(f, i);
+      depth = millimeters.data();
+    }
+    const uint8_t* rgb = f.rgb->data();
+    int channels = f.image_channels;
+    for (int y = 0; y < h; y++)
+      for (int x = 0; x < w; x++)
+      {
+        int i = y * w + x;
+        float* p = &points[3 * i];
+        uint8_t* c = &colors[3 * i];
+        bool flying = false;
+        for (int ny = std::max(y - 1, 0); max_jump > 0 && ny <= std::min(y + 1, h - 1); ny++)
+          for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, w - 1); nx++)
+          {
+            float e = depth[ny * w + nx];
+            flying = flying || (e > 0 && std::fabs(e - depth[i]) > max_jump * depth[i]);
+          }
+        if (!depth[i] || flying)
+        {
+          p[0] = p[1] = p[2] = nan;
+          c[0] = c[1] = c[2] = 0;
+          continue;
+        }
+        float d = depth[i] / 1000.f;
+        p[0] = (x - K[2]) * d / K[0];
+        p[1] = (y - K[3]) * d / K[1];
+        p[2] = d;
+        Eigen::Vector3f q = f.depth_to_image * Eigen::Vector3f(p[0], p[1], p[2]);
+        float z = std::max(q[2], 1e-3f);
+        int u = std::floor(C[0] * q[0] / z + C[2] + .5f), v = std::floor(C[1] * q[1] / z + C[3] + .5f);
+        u = std::min(std::max(u, 0), f.image_width - 1);
+        v = std::min(std::max(v, 0), f.image_height - 1);
+        const uint8_t* texel = rgb + (v * f.image_width + u) * channels;
+        for (int k = 0; k < 3; k++)
+          c[k] = texel[channels == 1 ? 0 : k];
+      }
+    return true;
+  }
+
+  /**
+   * Runs CloudProgram with transform feedback in a hidden window. Frames are
+   * unprojected into a ring of buffers and each is read back once its fence
+   * has passed. A tick waits up to COLLECT_WAIT for the frame it submitted,
+   * so a frame is out in one timer tick, and one the GPU takes longer on is
+   * collected on a later tick.
+   */
+  class DepthToCloudWindow: public GLWindow
+  {
+  public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    DepthToCloudWindow(const std::string& window_name)
+        :
+          GLWindow(window_name),
+          max_jump(0)
+    {
+      visible_ = false;
+    }
+
+    void
+    push(const CloudFrame& f)
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      pending = f;
+    }
+
+    /**
+     * The newest cloud. With depth given, waits up to timeout for the cloud
+     * of that frame first.
+     */
+    DepthCloud
+    result(const DepthDataConstPtr& depth, const boost::posix_time::time_duration& timeout)
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      boost::system_time until = boost::get_system_time() + timeout;
+      while (depth && latest.depth != depth)
+        if (!cond.timed_wait(lock, until))
+          break;
+      return latest;
+    }
+
+    virtual void
+    timerfunc(int)
+    {
+      collect(0);
+      submit();
+      collect(COLLECT_WAIT);
+    }
+
+    virtual void
+    init()
+    {
+      glewInit();
+      program.reset();
+      convert_program.reset();
+      cloud.reset();
+      in_flight.clear();
+
+      CHECK_GLUT_ERROR
+    }
+
+    void
+    destroy()
+    {
+      for (size_t i = 0; i < in_flight.size(); i++)
+        glDeleteSync(in_flight[i].fence);
+      in_flight.clear();
+      for (int i = 0; i < N_SLOTS; i++)
+      {
+        glDeleteBuffers(1, &slots[i].buffer);
+        slots[i] = Slot();
+      }
+      program.reset();
+      convert_program.reset();
+      cloud.reset();
+    }
+
+  private:
+    static const int N_SLOTS = 3;
+    static const GLuint64 COLLECT_WAIT = 10000000; //nanoseconds
+    struct Slot
+    {
+      Slot()
+          :
+            buffer(0),
+            bytes(0)
+      {
+      }
+      GLuint buffer;
+      size_t bytes;
+    };
+    struct InFlight
+    {
+      GLsync fence;
+      int slot;
+      DepthDataConstPtr depth;
+      size_t n;
+    };
+
+    /** Read back the finished clouds, oldest first, waiting up to timeout nanoseconds for each. */
+    void
+    collect(GLuint64 timeout)
+    {
+      while (!in_flight.empty())
+      {
+        InFlight& f = in_flight.front();
+        GLenum status = glClientWaitSync(f.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+          return;
+        glDeleteSync(f.fence);
+        DepthCloud c = unpack(slots[f.slot], f.depth, f.n);
+        in_flight.pop_front();
+        boost::mutex::scoped_lock lock(mtx);
+        latest = c;
+        cond.notify_all();
+      }
+    }
+
+    DepthCloud
+    unpack(const Slot& slot, const DepthDataConstPtr& depth, size_t n)
+    {
+      boost::shared_ptr<PointsData> points(new PointsData(3 * n));
+      boost::shared_ptr<RgbData> colors(new RgbData(3 * n));
+      const float nan = std::numeric_limits<float>::quiet_NaN();
+      glBindBuffer(GL_ARRAY_BUFFER, slot.buffer);
+      const float* src = (const float*) glMapBufferRange(GL_ARRAY_BUFFER, 0, n * CloudData::FEEDBACK_STEP,
+                                                         GL_MAP_READ_BIT);
+      if (src)
+      {
+        float* p = points->data();
+        uint8_t* c = colors->data();
+        for (size_t i = 0; i < n; i++, src += 4, p += 3, c += 3)
+        {
+          uint32_t rgb;
+          std::memcpy(&rgb, src + 3, sizeof(rgb));
+          if (src[2] > 0)
+          {
+            p[0] = src[0], p[1] = src[1], p[2] = src[2];
+            c[0] = rgb, c[1] = rgb >> 8, c[2] = rgb >> 16;
+          }
+          else
+          {
+            p[0] = p[1] = p[2] = nan;
+            c[0] = c[1] = c[2] = 0;
+          }
+        }
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      CHECK_GLUT_ERROR
+      DepthCloud cloud;
+      cloud.depth = depth;
+      cloud.points = points;
+      cloud.colors = colors;
+      return cloud;
+    }
+
+    /** Unproject the pending frame into a free slot, if there is one. */
+    void
+    submit()
+    {
+      if (in_flight.size() == size_t(N_SLOTS))
+        return;
+      CloudFrame frame;
+      {
+        boost::mutex::scoped_lock lock(mtx);
+        if (!pending.depth)
+          return;
+        frame = pending;
+        pending = CloudFrame();
+      }
+      if (!program)
+        program.reset(new CloudProgram(true));
+      if (!cloud)
+        cloud.reset(new CloudData);
+      if (frame.depth_format != DEPTH_MILLIMETERS && !convert_program)
+        convert_program = share_group_->resource<DepthConvertProgram>("depth_convert_program");
+      cloud->setData(frame, convert_program.get());
+      if (cloud->frame.depth != frame.depth)
+        return; //dropped as malformed
+
+      int s = in_flight.empty() ? 0 : (in_flight.back().slot + 1) % N_SLOTS;
+      Slot& slot = slots[s];
+      size_t bytes = frame.depth_width * frame.depth_height * CloudData::FEEDBACK_STEP;
+      if (!slot.buffer)
+        glGenBuffers(1, &slot.buffer);
+      if (bytes != slot.bytes)
+      {
+        glBindBuffer(GL_ARRAY_BUFFER, slot.buffer);
+        glBufferData(GL_ARRAY_BUFFER, bytes, 0, GL_STREAM_READ);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        slot.bytes = bytes;
+      }
+      cloud->feedback(*program, slot.buffer, max_jump);
+      InFlight f;
+      f.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      f.slot = s;
+      f.depth = frame.depth;
+      f.n = frame.depth_width * frame.depth_height;
+      in_flight.push_back(f);
+      glFlush();
+
+      CHECK_GLUT_ERROR
+    }
+
+    boost::shared_ptr<CloudProgram> program;
+    boost::shared_ptr<DepthConvertProgram> convert_program;
+    boost::shared_ptr<CloudData> cloud;
+    Slot slots[N_SLOTS];
+    std::deque<InFlight> in_flight;
+    boost::mutex mtx;
+    boost::condition_variable cond;
+    CloudFrame pending;
+    DepthCloud latest;
+
+  public:
+    float max_jump; //see CloudProgram, 0 keeps flying pixels
+  };
+
+  struct DepthToCloudGL
+  {
+    static void
+    declare_params(tendrils& params)
+    {
+      params.declare<std::string>("window_name", "A name for the hidden window that does the work.", "depth to cloud.");
+      params.declare<bool>("gpu", "Unproject on the GPU; false runs the same math on the CPU.", true);
+      params.declare<bool>("wait",
+                           "Wait for the cloud of the current frame, paced by the window's timer; false outputs the "
+                           "newest finished one, a frame or two behind, without stalling the plasm.",
+                           false);
+      params.declare<float>("max_jump",
+                            "Output flying pixels at depth edges as NaN: points whose depth differs from a neighbor's "
+                            "by more than this fraction of their own, such as 0.04. 0 keeps every point.",
+                            0);
+      params.declare<std::string>("depth_format",
+                                  "How depth is given: millimeters (uint16 in depth_buffer), meters (float in "
+                                  "depth_meters) or disparity (raw 11 bit Kinect disparity in depth_buffer). "
+                                  "Converted to millimeters, on the GPU with gpu.",
+                                  "millimeters");
+      params.declare<bool>("kinect_calibration",
+                           "For a Kinect running with registration=False: typical calibration of its depth and "
+                           "color cameras wherever depth_K, image_K, image_R and image_T are empty, so colors are "
+                           "registered to depth. Only as good as the unit is typical; the device's own "
+                           "registration or the unit's calibration is exact.",
+                           false);
+    }
+
+    static void
+    declare_io(const tendrils& params, tendrils& i, tendrils& o)
+    {
+      i.declare<int>("depth_width", "Depth frame width.");
+      i.declare<int>("depth_height", "Depth frame height.");
+      i.declare<int>("image_width", "Image frame width.");
+      i.declare<int>("image_height", "Image frame height.");
+      i.declare<int>("image_channels", "Number of image channels: 1 (gray), 3 (RGB) or 4 (RGBA).");
+      i.declare<DepthDataConstPtr>("depth_buffer");
+      i.declare<DepthMetersDataConstPtr>("depth_meters", "Depth in float meters, with depth_format meters.");
+      i.declare<RgbDataConstPtr>("image_buffer");
+      i.declare<cv::Mat>("depth_K", "3x3 depth camera matrix; empty for Kinect defaults at the depth resolution.");
+      i.declare<cv::Mat>("image_K",
+                         "3x3 color camera matrix; empty for the depth intrinsics scaled to the image resolution.");
+      i.declare<cv::Mat>("image_R",
+                         "Optional 3x3 rotation from the depth to the color camera frame, for depth not registered "
+                         "to the color image.");
+      i.declare<cv::Mat>("image_T", "Optional translation from the depth to the color camera frame, in meters.");
+      o.declare<PointsDataConstPtr>("points",
+                                    "Packed x, y, z floats in meters, one point per depth pixel in image order, NaN "
+                                    "where there is no depth.");
+      o.declare<RgbDataConstPtr>("colors", "Packed RGB bytes, one triple per point.");
+    }
+
+    void
+    configure(const tendrils& p, const tendrils& i, const tendrils& o)
+    {
+      depth_height = i["depth_height"];
+      depth_width = i["depth_width"];
+      image_width = i["image_width"];
+      image_height = i["image_height"];
+      image_channels = i["image_channels"];
+      image_buffer = i["image_buffer"];
+      depth_buffer = i["depth_buffer"];
+      depth_meters = i["depth_meters"];
+      depth_K = i["depth_K"];
+      image_K = i["image_K"];
+      image_R = i["image_R"];
+      image_T = i["image_T"];
+      points = o["points"];
+      colors = o["colors"];
+      window_name = p["window_name"];
+      gpu = p["gpu"];
+      wait = p["wait"];
+      max_jump = p["max_jump"];
+      kinect_calibration = p["kinect_calibration"];
+      depth_format = parseDepthFormat(p.get<std::string>("depth_format"));
+    }
+
+    int
+    process(const tendrils&, const tendrils&)
+    {
+      DepthDataConstPtr db = depth_format == DEPTH_METERS ? meters_identity(*depth_meters) : *depth_buffer;
+      if (!db || !*image_buffer)
+        return ecto::OK;
+      DepthDataConstPtr depth;
+      if (db != last_depth)
+      {
+        last_depth = depth = db;
+        CloudFrame f;
+        f.depth = db;
+        f.depth_meters = *depth_meters;
+        f.depth_format = depth_format;
+        f.rgb = *image_buffer;
+        setFrameGeometry(f, *depth_width, *depth_height, *image_width, *image_height, *image_channels, *depth_K,
+                         *image_K);
+        f.depth_to_image = poseFromRT(*image_R, *image_T);
+        if (*kinect_calibration)
+          setKinectCalibration(f, *depth_K, *image_K, *image_R, *image_T);
+        if (!*gpu)
+        {
+          boost::shared_ptr<PointsData> p(new PointsData);
+          boost::shared_ptr<RgbData> c(new RgbData);
+          if (!depthToCloud(f, *p, *c, *max_jump))
+          {
+            std::cerr << "Dropping a cloud frame smaller than its declared size." << std::endl;
+            return ecto::OK;
+          }
+          *points = p;
+          *colors = c;
+          return ecto::OK;
+        }
+        if (!window)
+        {
+          window.reset(new DepthToCloudWindow(*window_name));
+          window->max_jump = *max_jump;
+        }
+        window->push(f);
+      }
+      if (!window)
+        return ecto::OK;
+      ecto_gl::show_window(window);
+      DepthCloud c = window->result(*wait ? depth : DepthDataConstPtr(), boost::posix_time::seconds(1));
+      *points = c.points;
+      *colors = c.colors;
+      return ecto::OK;
+    }
+
+    ecto::spore<int> depth_width, depth_height, image_width, image_height, image_channels;
+    ecto::spore<DepthDataConstPtr> depth_buffer;
+    ecto::spore<DepthMetersDataConstPtr> depth_meters;
+    ecto::spore<RgbDataConstPtr> image_buffer;
+    ecto::spore<cv::Mat> depth_K, image_K, image_R, image_T;
+    ecto::spore<PointsDataConstPtr> points;
+    ecto::spore<RgbDataConstPtr> colors;
+    ecto::spore<std::string> window_name;
+    ecto::spore<bool> gpu, wait, kinect_calibration;
+    ecto::spore<float> max_jump;
+
+    DepthFormat depth_format;
+    DepthMetersIdentity meters_identity;
+
+    boost::shared_ptr<DepthToCloudWindow> window;
+    DepthDataConstPtr last_depth;
+  };
+}
+ECTO_CELL(ecto_gl, ecto_gl::DepthToCloudGL, "DepthToCloudGL",
+          "Unprojects depth frames to xyz and rgb on the GPU, by transform feedback")
@@ -1,7 +1,9 @@
 #include <algorithm>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <GL/glew.h>
+#include <boost/weak_ptr.hpp>
 
 #include "ecto_gl.hpp"
 
@@ -34,11 +36,96 @@ namespace ecto_gl
   using Eigen::Vector3f;
   using Eigen::Matrix4f;
 
-  GLWindow::GLWindow(const std::string& windowname)
+  Stat::Stat()
+      :
+        count(0),
+        sum(0),
+        min(0),
+        max(0)
+  {
+  }
+
+  void
+  Stat::add(double sample)
+  {
+    min = count ? std::min(min, sample) : sample;
+    max = count ? std::max(max, sample) : sample;
+    sum += sample;
+    ++count;
+  }
+
+  double
+  Stat::mean() const
+  {
+    return count ? sum / count : 0;
+  }
+
+  std::ostream&
+  operator<<(std::ostream& out, const Stat& stat)
+  {
+    out << "mean " << stat.mean() << " min " << stat.min << " max " << stat.max << " (" << stat.count << " samples)";
+    return out;
+  }
+
+  ShareGroup::ShareGroup(const std::string& name)
+      :
+        name_(name),
+        context_window_(-1),
+        members_(0)
+  {
+  }
+
+  ShareGroup::ptr
+  ShareGroup::get(const std::string& name)
+  {
+    static boost::mutex mtx;
+    static std::map<std::string, boost::weak_ptr<ShareGroup> > groups;
+    if (name.empty())
+      return ptr(new ShareGroup(name));
+    boost::mutex::scoped_lock lock(mtx);
+    ptr group = groups[name].lock();
+    if (!group)
+    {
+      group.reset(new ShareGroup(name));
+      groups[name] = group;
+    }
+    return group;
+  }
+
+  void
+  ShareGroup::release()
+  {
+    boost::mutex::scoped_lock lock(mtx_);
+    resources_.clear();
+  }
+
+  View::View(float x, float y, float width, float height)
+      :
+        x(x),
+        y(y),
+        width(width),
+        height(height)
+  {
+  }
+
+  GLWindow::GLWindow(const std::string& windowname, const std::string& share_group)
       :
         windowname_(windowname),
-        id_(-1)
+        id_(-1),
+        share_group_(ShareGroup::get(share_group)),
+        layout_("single"),
+        view_center_(Vector3f::Zero()),
+        readback_(false),
+        visible_(true),
+        swap_interval_(-1),
+        max_frames_in_flight_(0),
+        width_(0),
+        height_(0),
+        active_view_(-1),
+        layout_dirty_(false)
   {
+    main_rect_[0] = main_rect_[1] = 0;
+    main_rect_[2] = main_rect_[3] = 1;
   }
 
   GLWindow::~GLWindow()
@@ -55,18 +142,119 @@ namespace ecto_gl
   GLWindow::reshape(int width, int height)
   {
     glViewport(0, 0, width, height);
-    camera_.setViewport(width, height);
+    width_ = width;
+    height_ = height;
+    if (layout_dirty_)
+      applyLayout();
+    const float* r = main_rect_;
+    camera_.setViewport(r[0] * width, r[1] * height, r[2] * width, r[3] * height);
+    for (Views::iterator v = views_.begin(); v != views_.end(); ++v)
+      v->camera.setViewport(v->x * width, v->y * height, v->width * width, v->height * height);
+  }
+
+  void
+  GLWindow::setLayout(const std::string& layout)
+  {
+    if (layout != "single" && layout != "split" && layout != "pip" && layout != "quad")
+      throw std::runtime_error("Unknown layout " + layout + ", expected single, split, pip or quad.");
+    layout_ = layout;
+    layout_dirty_ = true;
+    if (width_ > 0)
+      reshape(width_, height_);
+  }
+
+  void
+  GLWindow::applyLayout()
+  {
+    layout_dirty_ = false;
+    active_view_ = -1;
+    views_.clear();
+    //front, top and side views look at view_center_ from camera_'s side, from above and from the right.
+    View front, top, side;
+    front.camera = top.camera = side.camera = camera_;
+    top.camera.setTarget(view_center_);
+    side.camera.setTarget(view_center_);
+    top.camera.rotateAroundTarget(Eigen::Quaternionf(Eigen::AngleAxisf(M_PI / 2, Vector3f::UnitX())));
+    side.camera.rotateAroundTarget(Eigen::Quaternionf(Eigen::AngleAxisf(M_PI / 2, Vector3f::UnitY())));
+    float* r = main_rect_;
+    r[0] = r[1] = 0;
+    r[2] = r[3] = 1;
+    if (layout_ == "split")
+    {
+      r[2] = 0.5;
+      side.x = 0.5;
+      side.width = 0.5;
+      views_.push_back(side);
+    }
+    else if (layout_ == "pip")
+    {
+      top.x = top.y = 0.7;
+      top.width = top.height = 0.3;
+      views_.push_back(top);
+    }
+    else if (layout_ == "quad")
+    {
+      r[1] = 0.5;
+      r[2] = r[3] = 0.5;
+      front.x = front.y = 0.5;
+      top.y = 0;
+      side.x = 0.5;
+      side.y = 0;
+      front.width = front.height = top.width = top.height = side.width = side.height = 0.5;
+      views_.push_back(front);
+      views_.push_back(top);
+      views_.push_back(side);
+    }
+  }
+
+  std::vector<Camera*>
+  GLWindow::cameras()
+  {
+    std::vector<Camera*> c(1, &camera_);
+    for (Views::iterator v = views_.begin(); v != views_.end(); ++v)
+      c.push_back(&v->camera);
+    return c;
+  }
+
+  void
+  GLWindow::beginView(const Camera& c)
+  {
+    glViewport(c.vpX(), c.vpY(), c.vpWidth(), c.vpHeight());
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(c.vpX(), c.vpY(), c.vpWidth(), c.vpHeight());
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+  }
+
+  Camera&
+  GLWindow::activeCamera()
+  {
+    if (active_view_ >= 0 && active_view_ < int(views_.size()))
+      return views_[active_view_].camera;
+    return camera_;
   }
 
   void
   GLWindow::mouse(const Mouse& mouse)
   {
     mouse_ = mouse;
+    if (mouse.state != GLUT_DOWN)
+      return;
+    //drags go to the topmost view under the cursor; GL counts rows from the bottom.
+    active_view_ = -1;
+    unsigned x = mouse.beginx, y = height_ - mouse.beginy;
+    for (int i = views_.size() - 1; i >= 0 && active_view_ < 0; i--)
+    {
+      const Camera& c = views_[i].camera;
+      if (x >= c.vpX() && x < c.vpX() + c.vpWidth() && y >= c.vpY() && y < c.vpY() + c.vpHeight())
+        active_view_ = i;
+    }
   }
 
   void
   GLWindow::motion(int x, int y)
   {
+    Camera& camera = activeCamera();
     Mouse m = mouse_;
     float delta_x = m.beginx - x, delta_y = m.beginy - y;
     if (m.button == GLUT_LEFT_BUTTON && m.state == GLUT_DOWN)
@@ -74,37 +262,37 @@ namespace ecto_gl
       if (m.modifiers & GLUT_ACTIVE_SHIFT)
       {
         //zoom in and out
-        camera_.setFovY(camera_.fovY() * (1.0f + (delta_y / camera_.vpWidth())));
+        camera.setFovY(camera.fovY() * (1.0f + (delta_y / camera.vpWidth())));
       }
       else
       {
-        Eigen::AngleAxisf ry(-delta_x / camera_.vpWidth(), Eigen::Vector3f(0, 1, 0));
-        Eigen::AngleAxisf rx(-delta_y / camera_.vpHeight(), Eigen::Vector3f(1, 0, 0));
+        Eigen::AngleAxisf ry(-delta_x / camera.vpWidth(), Eigen::Vector3f(0, 1, 0));
+        Eigen::AngleAxisf rx(-delta_y / camera.vpHeight(), Eigen::Vector3f(1, 0, 0));
         Eigen::Quaternionf qx(rx), qy(ry);
-        camera_.rotateAroundTarget(qy);
-        camera_.rotateAroundTarget(qx);
+        camera.rotateAroundTarget(qy);
+        camera.rotateAroundTarget(qx);
       }
     }
     else if (m.button == GLUT_MIDDLE_BUTTON && m.state == GLUT_DOWN)
     {
 
-      Vector3f X = camera_.position();
-      Eigen::Quaternionf q = camera_.orientation();
+      Vector3f X = camera.position();
+      Eigen::Quaternionf q = camera.orientation();
       float factor = 10;
 
       Vector3f dX;
       if (m.modifiers & GLUT_ACTIVE_SHIFT)
       {
         //move along the camera plane normal
-        dX = q * Vector3f(factor * delta_x / camera_.vpWidth(), 0, factor * (-delta_y) / camera_.vpHeight());
+        dX = q * Vector3f(factor * delta_x / camera.vpWidth(), 0, factor * (-delta_y) / camera.vpHeight());
       }
       else
       {
         //compute the delta x using the the camera orientation,
         //so that the motion is in the plane of the camera.
-        dX = q * Vector3f(factor * delta_x / camera_.vpWidth(), factor * (-delta_y) / camera_.vpHeight(), 0);
+        dX = q * Vector3f(factor * delta_x / camera.vpWidth(), factor * (-delta_y) / camera.vpHeight(), 0);
       }
-      camera_.setPosition(X + dX);
+      camera.setPosition(X + dX);
     }
     mouse_.beginx = x;
     mouse_.beginy = y;
@@ -149,4 +337,78 @@ namespace ecto_gl
   {
   }
 
+  void
+  GLWindow::readback(int width, int height)
+  {
+    if (width <= 0 || height <= 0)
+      return;
+    boost::shared_ptr<ReadbackImage> frame(new ReadbackImage);
+    frame->width = width;
+    frame->height = height;
+    frame->bgr.resize(width * height * 3);
+    std::vector<unsigned char> rows(frame->bgr.size());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, rows.data());
+    //GL reads bottom up.
+    size_t step = width * 3;
+    for (int y = 0; y < height; y++)
+      std::copy(rows.begin() + y * step, rows.begin() + (y + 1) * step, frame->bgr.begin() + (height - 1 - y) * step);
+    boost::mutex::scoped_lock lock(frame_mtx_);
+    frame_ = frame;
+  }
+
+  void
+  GLWindow::frameShowsData(const boost::posix_time::ptime& arrival)
+  {
+    frame_arrival_ = arrival;
+  }
+
+  void
+  GLWindow::setLowLatency()
+  {
+    swap_interval_ = 0;
+    max_frames_in_flight_ = 1;
+  }
+
+  void
+  GLWindow::presented()
+  {
+    if (!GLEW_ARB_sync)
+      return;
+    InFlight frame;
+    frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame.arrival = frame_arrival_;
+    frame_arrival_ = boost::posix_time::ptime();
+    in_flight_.push_back(frame);
+    //collect frames that are already done, then block on the oldest ones while over the limit.
+    retire(false);
+    while (max_frames_in_flight_ > 0 && int(in_flight_.size()) >= max_frames_in_flight_)
+      retire(true);
+  }
+
+  void
+  GLWindow::retire(bool wait)
+  {
+    while (!in_flight_.empty())
+    {
+      InFlight& frame = in_flight_.front();
+      GLenum status = glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GLuint64(1000000000) : 0);
+      if (status == GL_TIMEOUT_EXPIRED && !wait)
+        return;
+      if (status != GL_TIMEOUT_EXPIRED && !frame.arrival.is_not_a_date_time())
+        latency_ms_.add((boost::posix_time::microsec_clock::universal_time() - frame.arrival).total_microseconds() / 1000.);
+      glDeleteSync(frame.fence);
+      in_flight_.pop_front();
+      if (wait)
+        return;
+    }
+  }
+
+  ReadbackImageConstPtr
+  GLWindow::lastFrame() const
+  {
+    boost::mutex::scoped_lock lock(frame_mtx_);
+    return frame_;
+  }
+
 }
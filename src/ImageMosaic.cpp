@@ -0,0 +1,359 @@
+#include <ecto/ecto.hpp>
+#include <GL/glew.h>
+
+#include "ecto_gl.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/format.hpp>
+
+#include <opencv2/core/core.hpp>
+
+namespace ecto_gl
+{
+  using ecto::tendrils;
+  using ecto::spore;
+
+  /** Draws a texture into the current viewport with a quad made from gl_VertexID. */
+  struct MosaicProgram
+  {
+    MosaicProgram()
+    {
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          out vec2 uv;
+          void main()
+          {
+            vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+            uv = vec2(corner.x, 1. - corner.y);
+            gl_Position = vec4(corner * 2. - 1., 0., 1.);
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          uniform sampler2D image;
+          uniform float scale;
+          uniform bool gray;
+          in vec2 uv;
+          out vec4 frag_color;
+          void main()
+          {
+            vec4 t = texture(image, uv);
+            frag_color = vec4((gray ? t.rrr : t.rgb) * scale, 1.);
+          }
+      );
+      program.reset(new GlProgram(vertexShader, fragmentShader));
+      image = glGetUniformLocation(program->program, "image");
+      scale = glGetUniformLocation(program->program, "scale");
+      gray = glGetUniformLocation(program->program, "gray");
+
+      CHECK_GLUT_ERROR
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint image, scale, gray;
+  };
+
+  /**
+   * One input image as a texture, streamed through two pixel buffers used in
+   * turn, so filling one with a new frame does not wait on the texture upload
+   * from the other.
+   */
+  struct MosaicTile: boost::noncopyable
+  {
+    MosaicTile()
+        :
+          texture(0),
+          width(0),
+          height(0),
+          type(-1),
+          next_pbo(0),
+          bytes_uploaded(0)
+    {
+      glGenTextures(1, &texture);
+      glGenBuffers(2, pbos);
+    }
+
+    ~MosaicTile()
+    {
+      glDeleteBuffers(2, pbos);
+      glDeleteTextures(1, &texture);
+    }
+
+    void
+    upload(const cv::Mat& image)
+    {
+      GLenum format, datatype;
+      GLint internal;
+      if (!glFormat(image.type(), internal, format, datatype))
+      {
+        std::cerr << "ImageMosaic: unsupported image type " << image.type() << std::endl;
+        return;
+      }
+      size_t row = image.cols * image.elemSize();
+      size_t bytes = row * image.rows;
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[next_pbo]);
+      next_pbo = 1 - next_pbo;
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, 0, GL_STREAM_DRAW);
+      uint8_t* dst = (uint8_t*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+      if (dst)
+      {
+        for (int r = 0; r < image.rows; r++)
+          std::memcpy(dst + r * row, image.ptr<uint8_t>(r), row);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      }
+
+      glBindTexture(GL_TEXTURE_2D, texture);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      if (image.cols != width || image.rows != height || image.type() != type)
+      {
+        width = image.cols;
+        height = image.rows;
+        type = image.type();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal, width, height, 0, format, datatype, 0);
+      }
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, datatype, 0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      bytes_uploaded += bytes;
+
+      CHECK_GLUT_ERROR
+    }
+
+    /** Draw the texture fitted into the given rectangle, keeping its aspect ratio. */
+    void
+    draw(const MosaicProgram& program, int x, int y, int w, int h) const
+    {
+      if (type < 0 || !width || !height)
+        return;
+      float s = std::min(float(w) / width, float(h) / height);
+      int dw = width * s, dh = height * s;
+      glViewport(x + (w - dw) / 2, y + (h - dh) / 2, dw, dh);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, texture);
+      glUniform1i(program.image, 0);
+      glUniform1i(program.gray, CV_MAT_CN(type) == 1);
+      //16 bit images are usually depth in millimeters, show 0 to 10 meters.
+      glUniform1f(program.scale, CV_MAT_DEPTH(type) == CV_16U ? 65535.f / 10000.f : 1.f);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+      glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    static bool
+    glFormat(int cv_type, GLint& internal, GLenum& format, GLenum& datatype)
+    {
+      switch (cv_type)
+      {
+        case CV_8UC1:
+          internal = GL_R8, format = GL_RED, datatype = GL_UNSIGNED_BYTE;
+          return true;
+        case CV_8UC3:
+          internal = GL_RGB8, format = GL_BGR, datatype = GL_UNSIGNED_BYTE;
+          return true;
+        case CV_8UC4:
+          internal = GL_RGBA8, format = GL_BGRA, datatype = GL_UNSIGNED_BYTE;
+          return true;
+        case CV_16UC1:
+          internal = GL_R16, format = GL_RED, datatype = GL_UNSIGNED_SHORT;
+          return true;
+        case CV_32FC1:
+          internal = GL_R32F, format = GL_RED, datatype = GL_FLOAT;
+          return true;
+        case CV_32FC3:
+          internal = GL_RGB32F, format = GL_BGR, datatype = GL_FLOAT;
+          return true;
+        default:
+          return false;
+      }
+    }
+
+    GLuint texture, pbos[2];
+    int width, height, type;
+    int next_pbo;
+    size_t bytes_uploaded;
+  };
+
+  /** Tiles many images into one window, each scaled on the GPU. */
+  class MosaicWindow: public GLWindow
+  {
+  public:
+    MosaicWindow(const std::string& window_name, int n_tiles, int cols)
+        :
+          GLWindow(window_name),
+          pending(n_tiles),
+          cols(cols > 0 ? cols : std::ceil(std::sqrt(float(n_tiles)))),
+          rows((n_tiles + this->cols - 1) / this->cols),
+          width(0),
+          height(0),
+          frames_drawn(0),
+          quit(false)
+    {
+    }
+
+    /** Hand over a new image for a tile; tiles without new images keep their texture. */
+    void
+    setImage(int i, const cv::Mat& image)
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      pending[i] = image;
+    }
+
+    virtual void
+    display()
+    {
+      if (!program)
+        program.reset(new MosaicProgram);
+      while (tiles.size() < pending.size())
+        tiles.push_back(boost::shared_ptr<MosaicTile>(new MosaicTile));
+      {
+        boost::mutex::scoped_lock lock(mtx);
+        for (size_t i = 0; i < pending.size(); i++)
+          if (!pending[i].empty())
+          {
+            tiles[i]->upload(pending[i]);
+            pending[i] = cv::Mat();
+          }
+      }
+
+      glDisable(GL_DEPTH_TEST);
+      glClearColor(0.1f, 0.1f, 0.1f, 1.f);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      glUseProgram(program->program->program);
+      int w = width / cols, h = height / rows;
+      for (size_t i = 0; i < tiles.size(); i++)
+      {
+        int c = i % cols, r = i / cols;
+        tiles[i]->draw(*program, c * w, height - (r + 1) * h, w, h);
+      }
+      glUseProgram(0);
+      glViewport(0, 0, width, height);
+      ++frames_drawn;
+
+      CHECK_GLUT_ERROR
+    }
+
+    virtual void
+    reshape(int w, int h)
+    {
+      GLWindow::reshape(w, h);
+      width = w;
+      height = h;
+    }
+
+    virtual void
+    init()
+    {
+      program.reset();
+      tiles.clear();
+      glewInit();
+    }
+
+    void
+    keyboard(unsigned char key, int x, int y)
+    {
+      switch (key)
+      {
+        case 'q':
+          quit = true;
+          break;
+        case 's':
+        {
+          size_t bytes = 0;
+          for (size_t i = 0; i < tiles.size(); i++)
+            bytes += tiles[i]->bytes_uploaded;
+          std::cout << windowname_ << ": drew " << frames_drawn << " frames of " << tiles.size() << " tiles, uploaded "
+                    << bytes << " bytes" << std::endl;
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    void
+    destroy()
+    {
+      program.reset();
+      tiles.clear();
+    }
+
+    boost::shared_ptr<MosaicProgram> program;
+    std::vector<boost::shared_ptr<MosaicTile> > tiles;
+    std::vector<cv::Mat> pending;
+    boost::mutex mtx;
+    int cols, rows;
+    int width, height;
+    size_t frames_drawn;
+    bool quit;
+  };
+
+  struct ImageMosaic
+  {
+    static void
+    declare_params(tendrils& params)
+    {
+      params.declare<std::string>("window_name", "A name for the window.", "mosaic.");
+      params.declare<int>("n_inputs", "Number of images, given as inputs image_0 ... image_(n_inputs - 1).", 4);
+      params.declare<int>("cols", "Tiles per row; 0 picks a near square grid.", 0);
+    }
+
+    static void
+    declare_io(const tendrils& params, tendrils& i, tendrils& o)
+    {
+      int n = params.get<int>("n_inputs");
+      if (n < 1)
+        throw std::runtime_error("n_inputs must be at least 1");
+      for (int k = 0; k < n; k++)
+        i.declare<cv::Mat>(boost::str(boost::format("image_%d") % k),
+                           "8 bit gray, BGR or BGRA, 16 bit depth in millimeters, or float gray or BGR in [0, 1].");
+    }
+
+    void
+    configure(const tendrils& p, const tendrils& i, const tendrils& o)
+    {
+      window_name = p["window_name"];
+      cols = p["cols"];
+      int n = p.get<int>("n_inputs");
+      for (int k = 0; k < n; k++)
+        images.push_back(i[boost::str(boost::format("image_%d") % k)]);
+    }
+
+    int
+    process(const tendrils&, const tendrils&)
+    {
+      if (!window)
+        window.reset(new MosaicWindow(*window_name, images.size(), *cols));
+
+      if (window->quit)
+      {
+        ecto_gl::stop();
+        return ecto::QUIT;
+      }
+
+      ecto_gl::show_window(window);
+      for (size_t k = 0; k < images.size(); k++)
+      {
+        //only images written since the last call are streamed to the GPU, as a copy, since producers refill
+        //their outputs in place.
+        const cv::Mat& image = *images[k];
+        if (image.empty() || !images[k].dirty())
+          continue;
+        window->setImage(k, image.clone());
+      }
+      return ecto::OK;
+    }
+
+    std::vector<ecto::spore<cv::Mat> > images;
+    ecto::spore<std::string> window_name;
+    ecto::spore<int> cols;
+
+    boost::shared_ptr<MosaicWindow> window;
+  };
+}
+ECTO_CELL(ecto_gl, ecto_gl::ImageMosaic, "ImageMosaic", "Tiles many images into one GL window, scaled on the GPU")
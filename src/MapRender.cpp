@@ -0,0 +1,837 @@
+#include <ecto/ecto.hpp>
+#include <GL/glew.h>
+
+#include "ecto_gl.hpp"
+#include "cloud.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace ecto_gl
+{
+  using Eigen::Vector3f;
+  using Eigen::Matrix4f;
+
+  using ecto::tendrils;
+  using ecto::spore;
+
+  namespace
+  {
+    /** Threads kept for the life of a map, so a frame does not pay for creating them. */
+    class WorkerPool: boost::noncopyable
+    {
+    public:
+      explicit
+      WorkerPool(int threads)
+          :
+            size_(std::max(1, threads)),
+            f_(0),
+            n_(0),
+            parts_(0),
+            running_(0),
+            generation_(0)
+      {
+        for (int t = 1; t < size_; t++)
+          group_.create_thread(boost::bind(&WorkerPool::work, this, t));
+      }
+
+      ~WorkerPool()
+      {
+        group_.interrupt_all();
+        group_.join_all();
+      }
+
+      /** Run f(begin, end) over [0, n) split between the pool and the calling thread. */
+      void
+      run(int n, const boost::function<void
+      (int, int)>& f)
+      {
+        int parts = std::min(size_, n);
+        if (parts <= 1)
+        {
+          if (n > 0)
+            f(0, n);
+          return;
+        }
+        {
+          boost::mutex::scoped_lock lock(mtx_);
+          f_ = &f;
+          n_ = n;
+          parts_ = parts;
+          running_ = parts - 1;
+          ++generation_;
+        }
+        work_.notify_all();
+        f(0, n / parts);
+        boost::mutex::scoped_lock lock(mtx_);
+        while (running_)
+          done_.wait(lock);
+        f_ = 0;
+      }
+
+    private:
+      void
+      work(int t)
+      {
+        size_t seen = 0;
+        try
+        {
+          while (true)
+          {
+            const boost::function<void
+            (int, int)>* f;
+            int n, parts;
+            {
+              boost::mutex::scoped_lock lock(mtx_);
+              while (generation_ == seen)
+                work_.wait(lock);
+              seen = generation_;
+              f = f_;
+              n = n_;
+              parts = parts_;
+            }
+            if (t >= parts)
+              continue;
+            (*f)(n * t / parts, n * (t + 1) / parts);
+            boost::mutex::scoped_lock lock(mtx_);
+            if (--running_ == 0)
+              done_.notify_one();
+          }
+        } catch (const boost::thread_interrupted&)
+        {
+        }
+      }
+
+      int size_;
+      const boost::function<void
+      (int, int)>* f_;
+      int n_, parts_, running_;
+      size_t generation_;
+      boost::mutex mtx_;
+      boost::condition_variable work_, done_;
+      boost::thread_group group_;
+    };
+
+    int
+    floor_div(int v, int d)
+    {
+      return v >= 0 ? v / d : (v - d + 1) / d;
+    }
+  }
+
+  /** Integer coordinates of a chunk of CHUNK^3 voxels. */
+  struct ChunkKey
+  {
+    ChunkKey(int x = 0, int y = 0, int z = 0)
+        :
+          x(x),
+          y(y),
+          z(z)
+    {
+    }
+    bool
+    operator==(const ChunkKey& other) const
+    {
+      return x == other.x && y == other.y && z == other.z;
+    }
+    int x, y, z;
+  };
+
+  inline std::size_t
+  hash_value(const ChunkKey& k)
+  {
+    std::size_t seed = 0;
+    boost::hash_combine(seed, k.x);
+    boost::hash_combine(seed, k.y);
+    boost::hash_combine(seed, k.z);
+    return seed;
+  }
+
+  /** A map point as uploaded: position and color, 16 bytes. */
+  struct MapVertex
+  {
+    float x, y, z;
+    uint8_t r, g, b, a;
+  };
+
+  /**
+   * A world map of colored points in a hashed grid of voxels, grouped into
+   * chunks. Each voxel keeps the running mean position and color of the points
+   * that fell into it, so the map stays bounded by the voxel size however many
+   * frames go in. Chunks not touched for a while are evicted first once the map
+   * exceeds max_voxels.
+   */
+  class VoxelMap
+  {
+  public:
+    static const int CHUNK = 16;
+
+    VoxelMap(float voxel_size, size_t max_voxels, float max_range, int threads)
+        :
+          voxel_size(voxel_size),
+          max_voxels(max_voxels),
+          max_range(max_range),
+          threads(threads),
+          pool(threads),
+          n_voxels(0),
+          frame_count(0)
+    {
+    }
+
+    /**
+     * Fuse a frame into the map, in parallel: points are unprojected in row
+     * bands, then sorted into their chunks, then every touched chunk fuses its
+     * points independently of the others. Returns the touched and evicted chunks.
+     */
+    void
+    integrate(const CloudFrame& f, std::vector<ChunkKey>& touched, std::vector<ChunkKey>& evicted)
+    {
+      touched.clear();
+      evicted.clear();
+      if (!f.depth || f.depth->size() < size_t(f.depth_width * f.depth_height))
+        return;
+      ++frame_count;
+      int bands = std::max(1, threads);
+      samples.resize(bands);
+      pool.run(bands, boost::bind(&VoxelMap::unproject, this, boost::cref(f), bands, _1, _2));
+
+      std::vector<Chunk*> chunks;
+      Chunk* last = 0;
+      ChunkKey last_key;
+      for (int b = 0; b < bands; b++)
+        for (size_t i = 0; i < samples[b].size(); i++)
+        {
+          const Sample& s = samples[b][i];
+          if (!last || !(s.chunk == last_key))
+          {
+            last_key = s.chunk;
+            last = &chunks_[s.chunk];
+            if (last->pending.empty())
+            {
+              chunks.push_back(last);
+              touched.push_back(s.chunk);
+            }
+          }
+          last->pending.push_back(&s);
+        }
+
+      pool.run(chunks.size(), boost::bind(&VoxelMap::fuse, this, boost::ref(chunks), _1, _2));
+      for (size_t i = 0; i < chunks.size(); i++)
+      {
+        n_voxels += chunks[i]->voxels.size() - chunks[i]->fused_from;
+        chunks[i]->last_touched = frame_count;
+      }
+      if (n_voxels > max_voxels)
+        evict(evicted);
+    }
+
+    /**
+     * The chunk's voxels as vertices, for upload, in a shuffled order that is
+     * the same every time so a progressive draw can stop at any prefix.
+     */
+    void
+    pack(const ChunkKey& key, std::vector<MapVertex>& out) const
+    {
+      out.clear();
+      Chunks::const_iterator it = chunks_.find(key);
+      if (it == chunks_.end())
+        return;
+      const std::vector<Voxel>& voxels = it->second.voxels;
+      out.resize(voxels.size());
+      for (size_t i = 0; i < voxels.size(); i++)
+      {
+        const Voxel& v = voxels[i];
+        MapVertex& m = out[i];
+        m.x = v.x, m.y = v.y, m.z = v.z;
+        m.r = v.r, m.g = v.g, m.b = v.b, m.a = 255;
+      }
+      stableShuffle(out.begin(), out.end(), hash_value(key));
+    }
+
+    size_t
+    voxels() const
+    {
+      return n_voxels;
+    }
+
+    size_t
+    chunks() const
+    {
+      return chunks_.size();
+    }
+
+    float voxel_size;
+    size_t max_voxels;
+    float max_range;
+    int threads;
+
+  private:
+    struct Sample
+    {
+      ChunkKey chunk;
+      uint16_t voxel;
+      float x, y, z;
+      uint8_t r, g, b;
+    };
+
+    struct Voxel
+    {
+      float x, y, z;
+      float r, g, b;
+      uint32_t count;
+    };
+
+    struct Chunk
+    {
+      Chunk()
+          :
+            index(CHUNK * CHUNK * CHUNK, 0),
+            last_touched(0),
+            fused_from(0)
+      {
+      }
+      std::vector<uint16_t> index; //voxel -> 1 + its slot in voxels, 0 for empty
+      std::vector<Voxel> voxels;
+      std::vector<const Sample*> pending;
+      size_t last_touched;
+      size_t fused_from;
+    };
+    typedef boost::unordered_map<ChunkKey, Chunk> Chunks;
+
+    void
+    unproject(const CloudFrame& f, int bands, int begin, int end)
+    {
+      const Eigen::Vector4f& K = f.depth_K;
+      const Eigen::Vector4f& C = f.image_K;
+      const DepthData& depth = *f.depth;
+      const uint8_t* rgb = f.rgb && f.rgb->size() >= size_t(f.image_width * f.image_height * f.image_channels) ?
+          f.rgb->data() : 0;
+      for (int b = begin; b < end; b++)
+      {
+        std::vector<Sample>& out = samples[b];
+        out.clear();
+        for (int y = f.depth_height * b / bands; y < f.depth_height * (b + 1) / bands; y++)
+          for (int x = 0; x < f.depth_width; x++)
+          {
+            float d = depth[y * f.depth_width + x] / 1000.f;
+            if (d <= 0 || d > max_range)
+              continue;
+            Vector3f p((x - K[2]) * d / K[0], (y - K[3]) * d / K[1], d);
+            Sample s;
+            s.r = s.g = s.b = 255;
+            if (rgb)
+            {
+              int u = int(C[0] * p[0] / d + C[2] + .5f), v = int(C[1] * p[1] / d + C[3] + .5f);
+              u = std::min(std::max(u, 0), f.image_width - 1);
+              v = std::min(std::max(v, 0), f.image_height - 1);
+              const uint8_t* c = rgb + (v * f.image_width + u) * f.image_channels;
+              s.r = c[0];
+              s.g = f.image_channels >= 3 ? c[1] : c[0];
+              s.b = f.image_channels >= 3 ? c[2] : c[0];
+            }
+            Vector3f w = f.pose * p;
+            s.x = w[0], s.y = w[1], s.z = w[2];
+            int vx = int(std::floor(w[0] / voxel_size)), vy = int(std::floor(w[1] / voxel_size)), vz =
+                int(std::floor(w[2] / voxel_size));
+            s.chunk = ChunkKey(floor_div(vx, CHUNK), floor_div(vy, CHUNK), floor_div(vz, CHUNK));
+            s.voxel = ((vz - s.chunk.z * CHUNK) * CHUNK + vy - s.chunk.y * CHUNK) * CHUNK + vx - s.chunk.x * CHUNK;
+            out.push_back(s);
+          }
+      }
+    }
+
+    void
+    fuse(std::vector<Chunk*>& chunks, int begin, int end)
+    {
+      for (int i = begin; i < end; i++)
+      {
+        Chunk& chunk = *chunks[i];
+        chunk.fused_from = chunk.voxels.size();
+        for (size_t k = 0; k < chunk.pending.size(); k++)
+        {
+          const Sample& s = *chunk.pending[k];
+          uint16_t& slot = chunk.index[s.voxel];
+          if (!slot)
+          {
+            Voxel v =
+            { s.x, s.y, s.z, float(s.r), float(s.g), float(s.b), 1 };
+            chunk.voxels.push_back(v);
+            slot = chunk.voxels.size();
+            continue;
+          }
+          //a capped running mean, so the map follows slow drift.
+          Voxel& v = chunk.voxels[slot - 1];
+          float w = std::min<uint32_t>(v.count, 31), a = 1.f / (w + 1);
+          v.x += (s.x - v.x) * a, v.y += (s.y - v.y) * a, v.z += (s.z - v.z) * a;
+          v.r += (s.r - v.r) * a, v.g += (s.g - v.g) * a, v.b += (s.b - v.b) * a;
+          ++v.count;
+        }
+        chunk.pending.clear();
+      }
+    }
+
+    /** Drop the least recently touched chunks until the map is a tenth below its budget. */
+    void
+    evict(std::vector<ChunkKey>& evicted)
+    {
+      std::vector<std::pair<size_t, ChunkKey> > age;
+      for (Chunks::const_iterator it = chunks_.begin(); it != chunks_.end(); ++it)
+        age.push_back(std::make_pair(it->second.last_touched, it->first));
+      std::sort(age.begin(), age.end(), boost::bind(&std::pair<size_t, ChunkKey>::first, _1)
+                < boost::bind(&std::pair<size_t, ChunkKey>::first, _2));
+      for (size_t i = 0; i < age.size() && n_voxels > max_voxels * 9 / 10; i++)
+      {
+        Chunks::iterator it = chunks_.find(age[i].second);
+        n_voxels -= it->second.voxels.size();
+        chunks_.erase(it);
+        evicted.push_back(age[i].second);
+      }
+    }
+
+    WorkerPool pool;
+    Chunks chunks_;
+    std::vector<std::vector<Sample> > samples;
+    size_t n_voxels;
+    size_t frame_count;
+  };
+
+  struct MapProgram
+  {
+    MapProgram()
+    {
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          attribute vec3 position;
+          attribute vec3 rgb;
+          varying vec4 color;
+          uniform mat4 projection_modelview;
+          void main()
+          {
+            color = vec4(rgb, 1.);
+            gl_Position = projection_modelview * vec4(position, 1.);
+            gl_PointSize = 2.0;
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          varying vec4 color;
+          void main()
+          {
+            gl_FragColor = color;
+          }
+      );
+      program.reset(new GlProgram(vertexShader, fragmentShader));
+      projection_modelview = glGetUniformLocation(program->program, "projection_modelview");
+      positionHandle = glGetAttribLocation(program->program, "position");
+      rgbHandle = glGetAttribLocation(program->program, "rgb");
+
+      CHECK_GLUT_ERROR
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint projection_modelview, positionHandle, rgbHandle;
+  };
+
+  typedef boost::shared_ptr<const std::vector<MapVertex> > MapVerticesConstPtr;
+
+  /**
+   * Draws the map from a few large vertex buffers, pages, each cut into slots
+   * of one power of two size, and a chunk in the smallest slot it fits.
+   * process() hands over the vertices of touched chunks and the keys of
+   * evicted ones, and only their slots change on the GPU. A page is drawn with
+   * one glMultiDrawArrays over its chunks.
+   */
+  class MapWindow: public GLWindow
+  {
+  public:
+    MapWindow(const std::string& window_name)
+        :
+          GLWindow(window_name),
+          frames_drawn(0),
+          chunks_uploaded(0),
+          bytes_uploaded(0),
+          quit(false)
+    {
+    }
+
+    void
+    update(const ChunkKey& key, const MapVerticesConstPtr& vertices)
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      pending[key] = vertices;
+    }
+
+    void
+    evict(const ChunkKey& key)
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      pending[key] = MapVerticesConstPtr();
+    }
+
+    virtual void
+    display()
+    {
+      glEnable(GL_DEPTH_TEST);
+      glClearColor(0.0f, 0.0f, 0.0f, 1.f);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      if (!program)
+        program.reset(new MapProgram);
+      Updates updates;
+      {
+        boost::mutex::scoped_lock lock(mtx);
+        updates.swap(pending);
+      }
+      for (Updates::const_iterator it = updates.begin(); it != updates.end(); ++it)
+      {
+        Buffers::iterator b = buffers.find(it->first);
+        if (!it->second)
+        {
+          if (b != buffers.end())
+          {
+            release(b->second);
+            buffers.erase(b);
+          }
+          continue;
+        }
+        const std::vector<MapVertex>& v = *it->second;
+        if (b == buffers.end())
+          b = buffers.insert(std::make_pair(it->first, allocate(v.size()))).first;
+        else if (GLsizei(v.size()) > pages[b->second.page].slot_size)
+        {
+          release(b->second);
+          b->second = allocate(v.size());
+        }
+        const Page& page = pages[b->second.page];
+        glBindBuffer(GL_ARRAY_BUFFER, page.buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, b->second.first * sizeof(MapVertex), v.size() * sizeof(MapVertex), v.data());
+        b->second.n = v.size();
+        bytes_uploaded += v.size() * sizeof(MapVertex);
+        ++chunks_uploaded;
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      std::vector<Camera*> cameras = this->cameras();
+      if (cameras.size() == 1 && progressive.budget_)
+      {
+        size_t points = 0;
+        for (Buffers::const_iterator it = buffers.begin(); it != buffers.end(); ++it)
+          points += it->second.n;
+        progressive.draw(camera_, points, !updates.empty(),
+                         boost::bind(&MapWindow::draw, this, boost::cref(camera_), _1, _2));
+        ++frames_drawn;
+        return;
+      }
+      for (size_t i = 0; i < cameras.size(); i++)
+      {
+        if (cameras.size() > 1)
+          beginView(*cameras[i]);
+        draw(*cameras[i]);
+      }
+      ++frames_drawn;
+
+      CHECK_GLUT_ERROR
+    }
+
+    /** Draw the range [begin, end) of every chunk, as fractions of its vertices. */
+    void
+    draw(const Camera& c, double begin = 0, double end = 1)
+    {
+      glViewport(c.vpX(), c.vpY(), c.vpWidth(), c.vpHeight());
+      glUseProgram(program->program->program);
+      Matrix4f p = c.projectionMatrix() * c.viewMatrix().matrix();
+      glUniformMatrix4fv(program->projection_modelview, 1, false, p.data());
+      glEnableVertexAttribArray(program->positionHandle);
+      glEnableVertexAttribArray(program->rgbHandle);
+      glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+      for (size_t i = 0; i < pages.size(); i++)
+      {
+        pages[i].firsts.clear();
+        pages[i].counts.clear();
+      }
+      for (Buffers::const_iterator it = buffers.begin(); it != buffers.end(); ++it)
+      {
+        GLsizei first = begin * it->second.n, last = end * it->second.n;
+        if (last <= first)
+          continue;
+        Page& page = pages[it->second.page];
+        page.firsts.push_back(it->second.first + first);
+        page.counts.push_back(last - first);
+      }
+      for (size_t i = 0; i < pages.size(); i++)
+      {
+        if (pages[i].counts.empty())
+          continue;
+        glBindBuffer(GL_ARRAY_BUFFER, pages[i].buffer);
+        glVertexAttribPointer(program->positionHandle, 3, GL_FLOAT, GL_FALSE, sizeof(MapVertex), (void*) 0);
+        glVertexAttribPointer(program->rgbHandle, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(MapVertex),
+                              (void*) (3 * sizeof(float)));
+        glMultiDrawArrays(GL_POINTS, pages[i].firsts.data(), pages[i].counts.data(), pages[i].counts.size());
+      }
+      glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+      glDisableVertexAttribArray(program->positionHandle);
+      glDisableVertexAttribArray(program->rgbHandle);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      glUseProgram(0);
+
+      CHECK_GLUT_ERROR
+    }
+
+    virtual void
+    init()
+    {
+      program.reset();
+      buffers.clear();
+      pages.clear();
+      progressive.release();
+      camera_.setFovY(3.14f / 4);
+      camera_.setPosition(Vector3f(0, 0, -1));
+      camera_.setTarget(Vector3f(0, 0, 0));
+      Eigen::AngleAxisf aa(M_PI, Eigen::Vector3f(0, 0, 1));
+      Eigen::Quaternionf q(aa);
+      aa = Eigen::AngleAxisf(M_PI, Eigen::Vector3f(0, 1, 0));
+      q *= Eigen::Quaternionf(aa);
+      camera_.setOrientation(q);
+      view_center_ = Vector3f(0, 0, 2);
+      glewInit();
+
+      CHECK_GLUT_ERROR
+    }
+
+    void
+    keyboard(unsigned char key, int x, int y)
+    {
+      switch (key)
+      {
+        case 'q':
+          quit = true;
+          break;
+        case 's':
+        {
+          size_t points = 0;
+          for (Buffers::const_iterator it = buffers.begin(); it != buffers.end(); ++it)
+            points += it->second.n;
+          std::cout << windowname_ << ": drew " << frames_drawn << " frames of " << points << " points in "
+                    << buffers.size() << " chunks on " << pages.size() << " buffers, uploaded " << chunks_uploaded
+                    << " chunks, " << bytes_uploaded << " bytes" << std::endl;
+          Stat integrate;
+          {
+            boost::mutex::scoped_lock lock(mtx);
+            integrate = integrate_ms;
+          }
+          std::cout << "  integration time [ms]: " << integrate << std::endl;
+          if (progressive.budget_)
+            std::cout << "  point budget " << progressive.budget_ << ", " << int(progressive.done_ * 100)
+                      << "% drawn, gpu draw time [ms]: " << progressive.draw_ms_ << std::endl;
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    void
+    destroy()
+    {
+      program.reset();
+      for (size_t i = 0; i < pages.size(); i++)
+        glDeleteBuffers(1, &pages[i].buffer);
+      pages.clear();
+      buffers.clear();
+      progressive.release();
+    }
+
+    /** Vertices in a page; its slots hold MIN_SLOT to VoxelMap::CHUNK^3 vertices. */
+    static const int PAGE_VERTICES = 1 << 19;
+    static const int MIN_SLOT = 64;
+
+    /** Where a chunk's n vertices are: from vertex first of a page. */
+    struct Buffer
+    {
+      int page;
+      GLint first;
+      GLsizei n;
+    };
+
+    struct Page
+    {
+      GLuint buffer;
+      GLsizei slot_size;
+      std::vector<GLint> free; //first vertices of unused slots
+      std::vector<GLint> firsts; //the ranges of a draw
+      std::vector<GLsizei> counts;
+    };
+
+    typedef boost::unordered_map<ChunkKey, Buffer> Buffers;
+    typedef boost::unordered_map<ChunkKey, MapVerticesConstPtr> Updates;
+
+    /** A free slot for n vertices, from a new page if every page of its size is full. */
+    Buffer
+    allocate(size_t n)
+    {
+      GLsizei size = MIN_SLOT;
+      while (size < GLsizei(n))
+        size *= 2;
+      Buffer b;
+      b.n = 0;
+      for (b.page = 0; b.page < int(pages.size()); b.page++)
+        if (pages[b.page].slot_size == size && !pages[b.page].free.empty())
+          break;
+      if (b.page == int(pages.size()))
+      {
+        Page page;
+        page.slot_size = size;
+        for (GLint first = PAGE_VERTICES - size; first >= 0; first -= size)
+          page.free.push_back(first);
+        glGenBuffers(1, &page.buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, page.buffer);
+        glBufferData(GL_ARRAY_BUFFER, PAGE_VERTICES * sizeof(MapVertex), 0, GL_DYNAMIC_DRAW);
+        pages.push_back(page);
+      }
+      b.first = pages[b.page].free.back();
+      pages[b.page].free.pop_back();
+      return b;
+    }
+
+    void
+    release(const Buffer& b)
+    {
+      pages[b.page].free.push_back(b.first);
+    }
+
+    boost::shared_ptr<MapProgram> program;
+    Buffers buffers;
+    std::vector<Page> pages;
+    ProgressiveDraw progressive;
+    Updates pending; //null vertices mark an evicted chunk
+    boost::mutex mtx;
+    size_t frames_drawn, chunks_uploaded, bytes_uploaded;
+    Stat integrate_ms;
+    bool quit;
+  };
+
+  struct MapDisplay
+  {
+    static void
+    declare_params(tendrils& params)
+    {
+      params.declare<std::string>("window_name", "A name for the window.", "map.");
+      params.declare<float>("voxel_size", "Edge of a map voxel in meters; each keeps one fused point.", 0.01f);
+      params.declare<int>("max_voxels",
+                          "Voxel budget; beyond it the least recently seen chunks are evicted.", 20000000);
+      params.declare<float>("max_range", "Depth beyond this many meters is not mapped.", 4.f);
+      params.declare<int>("threads", "Threads for integrating a frame; 0 for one per core.", 0);
+      params.declare<std::string>("layout", "Views of the map: single, split, pip or quad.", "single");
+      params.declare<int>("point_budget",
+                          "Most points drawn per frame in the single layout, the rest filled in while the view "
+                          "rests; 0 draws all.",
+                          0);
+      params.declare<float>("target_fps", "Adapt the point budget to hold this frame rate; 0 keeps it fixed.", 0);
+    }
+
+    static void
+    declare_io(const tendrils& params, tendrils& i, tendrils& o)
+    {
+      i.declare<int>("depth_width", "Depth frame width.");
+      i.declare<int>("depth_height", "Depth frame height.");
+      i.declare<int>("image_width", "Image frame width.");
+      i.declare<int>("image_height", "Image frame height.");
+      i.declare<int>("image_channels", "Number of image channels: 1 (gray), 3 (RGB) or 4 (RGBA).");
+      i.declare<DepthDataConstPtr>("depth_buffer");
+      i.declare<RgbDataConstPtr>("image_buffer");
+      i.declare<cv::Mat>("depth_K", "3x3 depth camera matrix; empty for Kinect defaults at the depth resolution.");
+      i.declare<cv::Mat>("image_K",
+                         "3x3 color camera matrix; empty for the depth intrinsics scaled to the image resolution.");
+      i.declare<cv::Mat>("R", "3x3 rotation of the depth camera in the world.");
+      i.declare<cv::Mat>("T", "Translation of the depth camera in the world.");
+    }
+
+    void
+    configure(const tendrils& p, const tendrils& i, const tendrils& o)
+    {
+      depth_height = i["depth_height"];
+      depth_width = i["depth_width"];
+      image_width = i["image_width"];
+      image_height = i["image_height"];
+      image_channels = i["image_channels"];
+      image_buffer = i["image_buffer"];
+      depth_buffer = i["depth_buffer"];
+      depth_K = i["depth_K"];
+      image_K = i["image_K"];
+      R = i["R"];
+      T = i["T"];
+      window_name = p["window_name"];
+      layout = p["layout"];
+      point_budget = p["point_budget"];
+      target_fps = p["target_fps"];
+      int threads = p.get<int>("threads");
+      if (threads <= 0)
+        threads = std::max(1u, boost::thread::hardware_concurrency());
+      map.reset(new VoxelMap(p.get<float>("voxel_size"), p.get<int>("max_voxels"), p.get<float>("max_range"), threads));
+    }
+
+    int
+    process(const tendrils&, const tendrils&)
+    {
+      if (!window)
+      {
+        window.reset(new MapWindow(*window_name));
+        window->setLayout(*layout);
+        window->progressive.budget_ = std::max(0, *point_budget);
+        window->progressive.target_fps_ = *target_fps;
+      }
+
+      if (window->quit)
+      {
+        ecto_gl::stop();
+        return ecto::QUIT;
+      }
+
+      ecto_gl::show_window(window);
+      if (!*depth_buffer || *depth_buffer == last_depth)
+        return ecto::OK;
+      last_depth = *depth_buffer;
+
+      CloudFrame f;
+      f.depth = *depth_buffer;
+      f.rgb = *image_buffer;
+      f.pose = poseFromRT(*R, *T);
+      setFrameGeometry(f, *depth_width, *depth_height, *image_width, *image_height, *image_channels, *depth_K,
+                       *image_K);
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      map->integrate(f, touched, evicted);
+      for (size_t k = 0; k < evicted.size(); k++)
+        window->evict(evicted[k]);
+      for (size_t k = 0; k < touched.size(); k++)
+      {
+        boost::shared_ptr<std::vector<MapVertex> > vertices(new std::vector<MapVertex>);
+        map->pack(touched[k], *vertices);
+        if (!vertices->empty())
+          window->update(touched[k], vertices);
+      }
+      boost::mutex::scoped_lock lock(window->mtx);
+      window->integrate_ms.add((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1e3);
+      return ecto::OK;
+    }
+
+    ecto::spore<int> depth_width, depth_height, image_width, image_height, image_channels;
+    ecto::spore<DepthDataConstPtr> depth_buffer;
+    ecto::spore<RgbDataConstPtr> image_buffer;
+    ecto::spore<cv::Mat> depth_K, image_K, R, T;
+    ecto::spore<std::string> window_name, layout;
+    ecto::spore<int> point_budget;
+    ecto::spore<float> target_fps;
+
+    boost::shared_ptr<VoxelMap> map;
+    boost::shared_ptr<MapWindow> window;
+    DepthDataConstPtr last_depth;
+    std::vector<ChunkKey> touched, evicted;
+  };
+}
+ECTO_CELL(ecto_gl, ecto_gl::MapDisplay, "MapDisplay", "A growing world map of posed depth frames in a voxel hash")
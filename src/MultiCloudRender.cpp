@@ -0,0 +1,427 @@
+#include <ecto/ecto.hpp>
+#include <GL/glew.h>
+
+#include "ecto_gl.hpp"
+#include "cloud.hpp"
+
+#include <vector>
+#include <sstream>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/format.hpp>
+
+#include <opencv2/core/core.hpp>
+
+namespace ecto_gl
+{
+  using Eigen::Vector3f;
+  using Eigen::Matrix4f;
+  using ecto::tendrils;
+  using ecto::spore;
+
+  /**
+   * Unprojects every stream in one instanced draw: gl_InstanceID picks the
+   * stream, whose depth and color sit in its slot of two texture buffers, and
+   * whose intrinsics and pose come from uniform arrays.
+   */
+  struct MultiCloudProgram
+  {
+    static const int MAX_STREAMS = 16;
+
+    MultiCloudProgram()
+    {
+      std::string vertexShader = boost::str(boost::format("#version 140\n#define MAX_STREAMS %d\n") % int(MAX_STREAMS))
+          + SHADER_STR(
+          uniform samplerBuffer depth;
+          uniform samplerBuffer rgb;
+          uniform int slot_size;
+          uniform vec4 intrinsics[MAX_STREAMS];
+          uniform ivec2 sizes[MAX_STREAMS];
+          uniform mat4 poses[MAX_STREAMS];
+          uniform mat4 projection_modelview;
+          out vec4 color;
+          void main()
+          {
+            int s = gl_InstanceID;
+            int w = sizes[s].x;
+            int i = s * slot_size + gl_VertexID;
+            float d = texelFetch(depth, i).r * 65.535;
+            if (gl_VertexID >= w * sizes[s].y || d == 0.)
+            {
+              gl_Position = vec4(2., 2., 2., 1.);
+              return;
+            }
+            vec4 K = intrinsics[s];
+            float x = float(gl_VertexID % w);
+            float y = float(gl_VertexID / w);
+            vec4 position = vec4((x - K.z) * d / K.x, (y - K.w) * d / K.y, d, 1.);
+            color = vec4(texelFetch(rgb, 3 * i).r, texelFetch(rgb, 3 * i + 1).r, texelFetch(rgb, 3 * i + 2).r, 1.);
+            gl_Position = projection_modelview * poses[s] * position;
+            gl_PointSize = 2.0;
+          }
+      );
+
+      static const char fragmentShader[] = "#version 140\n" SHADER_STR(
+          in vec4 color;
+          out vec4 frag_color;
+          void main()
+          {
+            frag_color = color;
+          }
+      );
+      program.reset(new GlProgram(vertexShader.c_str(), fragmentShader));
+      projection_modelview = glGetUniformLocation(program->program, "projection_modelview");
+      slot_size = glGetUniformLocation(program->program, "slot_size");
+      intrinsics = glGetUniformLocation(program->program, "intrinsics");
+      sizes = glGetUniformLocation(program->program, "sizes");
+      poses = glGetUniformLocation(program->program, "poses");
+      depth = glGetUniformLocation(program->program, "depth");
+      rgb = glGetUniformLocation(program->program, "rgb");
+
+      CHECK_GLUT_ERROR
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint projection_modelview, slot_size, intrinsics, sizes, poses, depth, rgb;
+  };
+
+  /** One sensor's latest frame and calibration, as handed over by process(). */
+  struct Stream
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    Stream()
+        :
+          width(0),
+          height(0),
+          intrinsics(Eigen::Vector4f::Zero()),
+          pose(Eigen::Affine3f::Identity()),
+          dirty(false)
+    {
+    }
+    DepthDataConstPtr depth;
+    RgbDataConstPtr rgb;
+    int width, height;
+    Eigen::Vector4f intrinsics;
+    Eigen::Affine3f pose;
+    bool dirty;
+  };
+  typedef std::vector<Stream, Eigen::aligned_allocator<Stream> > Streams;
+
+  /**
+   * All streams live in one depth and one color buffer with a slot of equal
+   * size per stream. Only slots with new frames are re-uploaded, and all of
+   * them are drawn with a single glDrawArraysInstanced.
+   */
+  struct MultiCloudData: boost::noncopyable
+  {
+    MultiCloudData()
+        :
+          depth_buffer(0),
+          rgb_buffer(0),
+          depth_texture(0),
+          rgb_texture(0),
+          slot_size(0),
+          n_streams(0),
+          bytes_uploaded(0)
+    {
+      glGenBuffers(1, &depth_buffer);
+      glGenBuffers(1, &rgb_buffer);
+      glGenTextures(1, &depth_texture);
+      glGenTextures(1, &rgb_texture);
+    }
+
+    ~MultiCloudData()
+    {
+      glDeleteTextures(1, &depth_texture);
+      glDeleteTextures(1, &rgb_texture);
+      glDeleteBuffers(1, &depth_buffer);
+      glDeleteBuffers(1, &rgb_buffer);
+    }
+
+    /** Grow the slots to fit the largest stream, then upload the streams that changed. */
+    void
+    update(Streams& streams)
+    {
+      int size = 0;
+      for (size_t i = 0; i < streams.size(); i++)
+        size = std::max(size, streams[i].width * streams[i].height);
+      if (size > slot_size || int(streams.size()) != n_streams)
+      {
+        slot_size = std::max(size, slot_size);
+        n_streams = streams.size();
+        allocate(depth_buffer, depth_texture, GL_R16, sizeof(uint16_t) * slot_size * n_streams);
+        allocate(rgb_buffer, rgb_texture, GL_R8, 3 * slot_size * n_streams);
+        for (size_t i = 0; i < streams.size(); i++)
+          streams[i].dirty = bool(streams[i].depth);
+      }
+      for (size_t i = 0; i < streams.size(); i++)
+      {
+        Stream& s = streams[i];
+        if (!s.dirty)
+          continue;
+        s.dirty = false;
+        size_t n = std::min<size_t>(s.depth->size(), slot_size);
+        glBindBuffer(GL_TEXTURE_BUFFER, depth_buffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, sizeof(uint16_t) * i * slot_size, sizeof(uint16_t) * n, s.depth->data());
+        bytes_uploaded += sizeof(uint16_t) * n;
+        if (s.rgb)
+        {
+          n = std::min<size_t>(s.rgb->size(), 3 * slot_size);
+          glBindBuffer(GL_TEXTURE_BUFFER, rgb_buffer);
+          glBufferSubData(GL_TEXTURE_BUFFER, 3 * i * slot_size, n, s.rgb->data());
+          bytes_uploaded += n;
+        }
+      }
+      glBindBuffer(GL_TEXTURE_BUFFER, 0);
+      CHECK_GLUT_ERROR
+    }
+
+    void
+    draw(const MultiCloudProgram& program, const Streams& streams, const Camera& c)
+    {
+      if (!n_streams || !slot_size)
+        return;
+      std::vector<float> intrinsics(4 * n_streams), poses(16 * n_streams);
+      std::vector<int> sizes(2 * n_streams);
+      for (int i = 0; i < n_streams; i++)
+      {
+        Eigen::Map<Eigen::Vector4f> K(&intrinsics[4 * i]);
+        Eigen::Map<Matrix4f> pose(&poses[16 * i]);
+        K = streams[i].intrinsics;
+        pose = streams[i].pose.matrix();
+        sizes[2 * i] = streams[i].depth ? streams[i].width : 0;
+        sizes[2 * i + 1] = streams[i].depth ? streams[i].height : 0;
+      }
+
+      glViewport(c.vpX(), c.vpY(), c.vpWidth(), c.vpHeight());
+      glUseProgram(program.program->program);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_BUFFER, depth_texture);
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_BUFFER, rgb_texture);
+      glUniform1i(program.depth, 0);
+      glUniform1i(program.rgb, 1);
+      glUniform1i(program.slot_size, slot_size);
+      glUniform4fv(program.intrinsics, n_streams, intrinsics.data());
+      glUniform2iv(program.sizes, n_streams, sizes.data());
+      glUniformMatrix4fv(program.poses, n_streams, false, poses.data());
+      Matrix4f p = c.projectionMatrix() * c.viewMatrix().matrix();
+      glUniformMatrix4fv(program.projection_modelview, 1, false, p.data());
+
+      glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+      glDrawArraysInstanced(GL_POINTS, 0, slot_size, n_streams);
+      glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+      glBindTexture(GL_TEXTURE_BUFFER, 0);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_BUFFER, 0);
+      glUseProgram(0);
+
+      CHECK_GLUT_ERROR
+    }
+
+    GLuint depth_buffer, rgb_buffer, depth_texture, rgb_texture;
+    int slot_size, n_streams;
+    size_t bytes_uploaded;
+
+  private:
+    void
+    allocate(GLuint buffer, GLuint texture, GLenum format, size_t bytes)
+    {
+      glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+      glBufferData(GL_TEXTURE_BUFFER, bytes, 0, GL_DYNAMIC_DRAW);
+      glBindBuffer(GL_TEXTURE_BUFFER, 0);
+      glBindTexture(GL_TEXTURE_BUFFER, texture);
+      glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+      glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+  };
+
+  class MultiCloudWindow: public GLWindow
+  {
+  public:
+    MultiCloudWindow(const std::string window_name, int n_streams)
+        :
+          GLWindow(window_name),
+          streams(n_streams),
+          pending(n_streams),
+          frames_drawn(0),
+          quit(false)
+    {
+    }
+
+    void
+    setStream(int i, const Stream& s)
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      pending[i] = s;
+      pending[i].dirty = true;
+    }
+
+    virtual void
+    display()
+    {
+      glEnable(GL_DEPTH_TEST);
+      glClearColor(0.0f, 0.0f, 0.0f, 1.f);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+      if (!program)
+        program.reset(new MultiCloudProgram);
+      if (!data)
+        data.reset(new MultiCloudData);
+      {
+        boost::mutex::scoped_lock lock(mtx);
+        for (size_t i = 0; i < pending.size(); i++)
+          if (pending[i].dirty)
+          {
+            streams[i] = pending[i];
+            pending[i].dirty = false;
+            pending[i].depth.reset();
+            pending[i].rgb.reset();
+          }
+      }
+      data->update(streams);
+      data->draw(*program, streams, camera_);
+      ++frames_drawn;
+
+      CHECK_GLUT_ERROR
+    }
+
+    virtual void
+    init()
+    {
+      program.reset();
+      data.reset();
+      camera_.setFovY(3.14f / 4);
+      camera_.setPosition(Vector3f(0, 0, -1));
+      camera_.setTarget(Vector3f(0, 0, 0));
+      Eigen::AngleAxisf aa(M_PI, Eigen::Vector3f(0, 0, 1));
+      Eigen::Quaternionf q(aa);
+      aa = Eigen::AngleAxisf(M_PI, Eigen::Vector3f(0, 1, 0));
+      q *= Eigen::Quaternionf(aa);
+      camera_.setOrientation(q);
+      glewInit();
+
+      CHECK_GLUT_ERROR
+    }
+
+    void
+    keyboard(unsigned char key, int x, int y)
+    {
+      switch (key)
+      {
+        case 'q':
+          quit = true;
+          break;
+        case 's':
+          if (data)
+            std::cout << windowname_ << ": drew " << frames_drawn << " frames of " << streams.size()
+                      << " streams with one draw call each, uploaded " << data->bytes_uploaded << " bytes" << std::endl;
+          break;
+        default:
+          break;
+      }
+    }
+
+    void
+    destroy()
+    {
+      program.reset();
+      data.reset();
+    }
+
+    boost::shared_ptr<MultiCloudProgram> program;
+    boost::shared_ptr<MultiCloudData> data;
+    Streams streams, pending;
+    boost::mutex mtx;
+    size_t frames_drawn;
+    bool quit;
+  };
+
+  struct MultiCloudDisplay
+  {
+    static void
+    declare_params(tendrils& params)
+    {
+      params.declare<std::string>("window_name", "A name for the window.", "clouds.");
+      params.declare<int>("n_streams",
+                          "Number of depth/RGB streams, each with inputs suffixed _0 ... _(n_streams - 1). At most 16.",
+                          2);
+    }
+
+    static void
+    declare_io(const tendrils& params, tendrils& i, tendrils& o)
+    {
+      int n = params.get<int>("n_streams");
+      if (n < 1 || n > MultiCloudProgram::MAX_STREAMS)
+        throw std::runtime_error(boost::str(boost::format("n_streams must be in [1, %d]") % int(MultiCloudProgram::MAX_STREAMS)));
+      for (int k = 0; k < n; k++)
+      {
+        std::string s = boost::str(boost::format("_%d") % k);
+        i.declare<int>("depth_width" + s, "Depth frame width.", 640);
+        i.declare<int>("depth_height" + s, "Depth frame height.", 480);
+        i.declare<DepthDataConstPtr>("depth_buffer" + s);
+        i.declare<RgbDataConstPtr>("image_buffer" + s, "RGB image registered to the depth frame.");
+        i.declare<cv::Mat>("K" + s, "3x3 depth camera matrix; empty for a Kinect-like default.");
+        i.declare<cv::Mat>("R" + s, "3x3 rotation of the sensor in the common frame; empty for identity.");
+        i.declare<cv::Mat>("T" + s, "3x1 translation of the sensor in the common frame; empty for zero.");
+      }
+    }
+
+    void
+    configure(const tendrils& p, const tendrils& i, const tendrils& o)
+    {
+      window_name = p["window_name"];
+      int n = p.get<int>("n_streams");
+      for (int k = 0; k < n; k++)
+      {
+        std::string s = boost::str(boost::format("_%d") % k);
+        depth_width.push_back(i["depth_width" + s]);
+        depth_height.push_back(i["depth_height" + s]);
+        depth_buffer.push_back(i["depth_buffer" + s]);
+        image_buffer.push_back(i["image_buffer" + s]);
+        K.push_back(i["K" + s]);
+        R.push_back(i["R" + s]);
+        T.push_back(i["T" + s]);
+      }
+    }
+
+    int
+    process(const tendrils&, const tendrils&)
+    {
+      if (!window)
+        window.reset(new MultiCloudWindow(*window_name, depth_buffer.size()));
+
+      if (window->quit)
+      {
+        ecto_gl::stop();
+        return ecto::QUIT;
+      }
+
+      ecto_gl::show_window(window);
+      for (size_t k = 0; k < depth_buffer.size(); k++)
+      {
+        if (!*depth_buffer[k])
+          continue;
+        Stream s;
+        s.depth = *depth_buffer[k];
+        s.rgb = *image_buffer[k];
+        s.width = *depth_width[k];
+        s.height = *depth_height[k];
+        s.intrinsics = intrinsicsFromK(*K[k], s.width, s.height);
+        s.pose = poseFromRT(*R[k], *T[k]);
+        window->setStream(k, s);
+      }
+      return ecto::OK;
+    }
+
+    std::vector<ecto::spore<int> > depth_width, depth_height;
+    std::vector<ecto::spore<DepthDataConstPtr> > depth_buffer;
+    std::vector<ecto::spore<RgbDataConstPtr> > image_buffer;
+    std::vector<ecto::spore<cv::Mat> > K, R, T;
+    ecto::spore<std::string> window_name;
+
+    boost::shared_ptr<MultiCloudWindow> window;
+  };
+}
+ECTO_CELL(ecto_gl, ecto_gl::MultiCloudDisplay, "MultiCloudDisplay",
+          "A glut point cloud viewer for several calibrated depth sensors, drawn in one batched call")
@@ -0,0 +1,484 @@
+#include <ecto/ecto.hpp>
+#include <GL/glew.h>
+
+#include "ecto_gl.hpp"
+#include "octree.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <list>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ecto_gl
+{
+  using Eigen::Vector3f;
+  using Eigen::Vector4f;
+  using Eigen::Matrix4f;
+
+  using ecto::tendrils;
+  using ecto::spore;
+
+  /** An octree file mapped into memory; node points are paged in as they are read. */
+  class OctreeFile: boost::noncopyable
+  {
+  public:
+    OctreeFile(const std::string& path)
+        :
+          data_(0),
+          bytes_(0)
+    {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+        throw std::runtime_error("Can not open " + path);
+      struct stat st;
+      fstat(fd, &st);
+      bytes_ = st.st_size;
+      data_ = (const char*) mmap(0, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (data_ == MAP_FAILED)
+        throw std::runtime_error("Can not map " + path);
+      header = (const OctreeHeader*) data_;
+      if (bytes_ < sizeof(OctreeHeader) || std::memcmp(header->magic, OCTREE_MAGIC, 8)
+          || bytes_ < sizeof(OctreeHeader) + header->n_points * sizeof(OctreePoint) + header->n_nodes * sizeof(OctreeNode))
+      {
+        munmap((void*) data_, bytes_);
+        throw std::runtime_error(path + " is not an octree from ecto_gl_octree_build.");
+      }
+      points = (const OctreePoint*) (data_ + sizeof(OctreeHeader));
+      nodes = (const OctreeNode*) (points + header->n_points);
+    }
+
+    ~OctreeFile()
+    {
+      munmap((void*) data_, bytes_);
+    }
+
+    /** Ask the kernel to start reading a node's points ahead of use. */
+    void
+    prefetch(int node) const
+    {
+      const char* begin = (const char*) (points + nodes[node].first);
+      size_t page = sysconf(_SC_PAGESIZE);
+      const char* aligned = data_ + (begin - data_) / page * page;
+      madvise((void*) aligned, begin - aligned + nodes[node].count * sizeof(OctreePoint), MADV_WILLNEED);
+    }
+
+    const OctreeHeader* header;
+    const OctreeNode* nodes;
+    const OctreePoint* points;
+
+  private:
+    const char* data_;
+    size_t bytes_;
+  };
+
+  /**
+   * Node vertex buffers on the GPU, bounded in bytes. Buffers not used for the
+   * longest time are deleted first, but never one the current frame draws.
+   */
+  class OctreeCache: boost::noncopyable
+  {
+  public:
+    OctreeCache(size_t budget)
+        :
+          budget(budget),
+          bytes(0),
+          loads(0),
+          evictions(0)
+    {
+    }
+
+    ~OctreeCache()
+    {
+      for (Entries::iterator it = entries_.begin(); it != entries_.end(); ++it)
+        glDeleteBuffers(1, &it->second.buffer);
+    }
+
+    /** The node's buffer, marked as used in this frame, or 0 if not loaded. */
+    GLuint
+    use(int node, size_t frame)
+    {
+      Entries::iterator it = entries_.find(node);
+      if (it == entries_.end())
+        return 0;
+      lru_.splice(lru_.begin(), lru_, it->second.lru);
+      it->second.frame = frame;
+      return it->second.buffer;
+    }
+
+    void
+    load(int node, const OctreeFile& file, size_t frame)
+    {
+      const OctreeNode& n = file.nodes[node];
+      Entry e;
+      e.bytes = n.count * sizeof(OctreePoint);
+      e.frame = frame;
+      glGenBuffers(1, &e.buffer);
+      glBindBuffer(GL_ARRAY_BUFFER, e.buffer);
+      glBufferData(GL_ARRAY_BUFFER, e.bytes, file.points + n.first, GL_STATIC_DRAW);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      lru_.push_front(node);
+      e.lru = lru_.begin();
+      entries_[node] = e;
+      bytes += e.bytes;
+      ++loads;
+      while (bytes > budget && !lru_.empty())
+      {
+        Entries::iterator victim = entries_.find(lru_.back());
+        if (victim->second.frame == frame)
+          break;
+        glDeleteBuffers(1, &victim->second.buffer);
+        bytes -= victim->second.bytes;
+        lru_.pop_back();
+        entries_.erase(victim);
+        ++evictions;
+      }
+    }
+
+    size_t
+    size() const
+    {
+      return entries_.size();
+    }
+
+    size_t budget, bytes;
+    size_t loads, evictions;
+
+  private:
+    struct Entry
+    {
+      GLuint buffer;
+      size_t bytes, frame;
+      std::list<int>::iterator lru;
+    };
+    typedef boost::unordered_map<int, Entry> Entries;
+    Entries entries_;
+    std::list<int> lru_; //most recently used first
+  };
+
+  struct OctreeProgram
+  {
+    OctreeProgram()
+    {
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          attribute vec3 position;
+          attribute vec3 rgb;
+          varying vec4 color;
+          uniform mat4 projection_modelview;
+          void main()
+          {
+            color = vec4(rgb, 1.);
+            gl_Position = projection_modelview * vec4(position, 1.);
+            gl_PointSize = 2.0;
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          varying vec4 color;
+          void main()
+          {
+            gl_FragColor = color;
+          }
+      );
+      program.reset(new GlProgram(vertexShader, fragmentShader));
+      projection_modelview = glGetUniformLocation(program->program, "projection_modelview");
+      positionHandle = glGetAttribLocation(program->program, "position");
+      rgbHandle = glGetAttribLocation(program->program, "rgb");
+
+      CHECK_GLUT_ERROR
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint projection_modelview, positionHandle, rgbHandle;
+  };
+
+  /**
+   * Views an octree file of any size. Each frame walks the tree from the root,
+   * largest nodes on screen first, skipping nodes outside the view and
+   * refining only where a node's points are further apart on screen than
+   * min_spacing pixels, up to point_budget points. Visible nodes that are not
+   * on the GPU yet are loaded a few per frame, so the view starts coarse and
+   * fills in.
+   */
+  class OctreeWindow: public GLWindow
+  {
+  public:
+    OctreeWindow(const std::string& window_name, const std::string& path)
+        :
+          GLWindow(window_name),
+          path(path),
+          min_spacing(1.5f),
+          point_budget(10000000),
+          loads_per_frame(16),
+          cache_bytes(size_t(512) << 20),
+          frames_drawn(0),
+          points_drawn(0),
+          complete(false),
+          quit(false)
+    {
+    }
+
+    virtual void
+    display()
+    {
+      glEnable(GL_DEPTH_TEST);
+      glClearColor(0.0f, 0.0f, 0.0f, 1.f);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      if (!file)
+        return;
+      if (!program)
+        program.reset(new OctreeProgram);
+      if (!cache)
+        cache.reset(new OctreeCache(cache_bytes));
+
+      ++frames_drawn;
+      std::vector<Camera*> cameras = this->cameras();
+      for (size_t i = 0; i < cameras.size(); i++)
+      {
+        if (cameras.size() > 1)
+          beginView(*cameras[i]);
+        draw(*cameras[i]);
+      }
+
+      CHECK_GLUT_ERROR
+    }
+
+    /** Nodes to draw for this camera, most important first. */
+    void
+    select(const Camera& c, std::vector<int>& visible)
+    {
+      visible.clear();
+      Matrix4f pv = c.projectionMatrix() * c.viewMatrix().matrix();
+      float pixels_per_radian = c.vpHeight() / (2 * std::tan(c.fovY() / 2));
+      std::priority_queue<std::pair<float, int> > queue;
+      queue.push(std::make_pair(1e30f, 0));
+      size_t points = 0;
+      while (!queue.empty() && points < point_budget)
+      {
+        int id = queue.top().second;
+        queue.pop();
+        const OctreeNode& node = file->nodes[id];
+        visible.push_back(id);
+        points += node.count;
+        for (int k = 0; k < 8; k++)
+        {
+          int child = node.children[k];
+          if (child < 0)
+            continue;
+          const OctreeNode& n = file->nodes[child];
+          if (!inView(pv, n))
+            continue;
+          //the parent's spacing on screen decides whether the child is needed.
+          Vector3f center = Vector3f(n.min[0], n.min[1], n.min[2]) + Vector3f::Constant(n.size / 2);
+          float distance = std::max((center - c.position()).norm() - n.size * .866f, c.nearDist());
+          float projected = node.spacing / distance * pixels_per_radian;
+          if (projected > min_spacing)
+            queue.push(std::make_pair(projected, child));
+        }
+      }
+    }
+
+    /** Clip space test of the node's cube against the view volume. */
+    static bool
+    inView(const Matrix4f& pv, const OctreeNode& n)
+    {
+      int outside[6] =
+      { 0, 0, 0, 0, 0, 0 };
+      for (int k = 0; k < 8; k++)
+      {
+        Vector4f p = pv
+            * Vector4f(n.min[0] + (k & 1) * n.size, n.min[1] + (k >> 1 & 1) * n.size, n.min[2] + (k >> 2 & 1) * n.size,
+                       1);
+        for (int a = 0; a < 3; a++)
+        {
+          outside[2 * a] += p[a] < -p[3];
+          outside[2 * a + 1] += p[a] > p[3];
+        }
+      }
+      for (int i = 0; i < 6; i++)
+        if (outside[i] == 8)
+          return false;
+      return true;
+    }
+
+    void
+    draw(const Camera& c)
+    {
+      if (!inView(c.projectionMatrix() * c.viewMatrix().matrix(), file->nodes[0]))
+        return;
+      std::vector<int> visible;
+      select(c, visible);
+
+      //load the most important missing nodes, and have the kernel read ahead the next ones.
+      int loaded = 0, prefetched = 0;
+      for (size_t i = 0; i < visible.size(); i++)
+      {
+        if (cache->use(visible[i], frames_drawn))
+          continue;
+        if (loaded < loads_per_frame)
+        {
+          cache->load(visible[i], *file, frames_drawn);
+          ++loaded;
+        }
+        else if (prefetched++ < loads_per_frame)
+          file->prefetch(visible[i]);
+      }
+      complete = loaded == 0;
+
+      glViewport(c.vpX(), c.vpY(), c.vpWidth(), c.vpHeight());
+      glUseProgram(program->program->program);
+      Matrix4f p = c.projectionMatrix() * c.viewMatrix().matrix();
+      glUniformMatrix4fv(program->projection_modelview, 1, false, p.data());
+      glEnableVertexAttribArray(program->positionHandle);
+      glEnableVertexAttribArray(program->rgbHandle);
+      glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+      points_drawn = 0;
+      for (size_t i = 0; i < visible.size(); i++)
+      {
+        GLuint buffer = cache->use(visible[i], frames_drawn);
+        if (!buffer)
+          continue;
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glVertexAttribPointer(program->positionHandle, 3, GL_FLOAT, GL_FALSE, sizeof(OctreePoint), (void*) 0);
+        glVertexAttribPointer(program->rgbHandle, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(OctreePoint),
+                              (void*) (3 * sizeof(float)));
+        glDrawArrays(GL_POINTS, 0, file->nodes[visible[i]].count);
+        points_drawn += file->nodes[visible[i]].count;
+      }
+      glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+      glDisableVertexAttribArray(program->positionHandle);
+      glDisableVertexAttribArray(program->rgbHandle);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      glUseProgram(0);
+
+      CHECK_GLUT_ERROR
+    }
+
+    virtual void
+    init()
+    {
+      program.reset();
+      cache.reset();
+      try
+      {
+        file.reset(new OctreeFile(path));
+      } catch (const std::exception& e)
+      {
+        std::cerr << e.what() << std::endl;
+        return;
+      }
+      //look at the whole cloud down +z, as the cloud windows do.
+      const OctreeNode& root = file->nodes[0];
+      Vector3f center = Vector3f(root.min[0], root.min[1], root.min[2]) + Vector3f::Constant(root.size / 2);
+      camera_.setFovY(3.14f / 4);
+      camera_.setClipPlanes(std::max(root.size * 1e-4f, 1e-3f), root.size * 10);
+      Eigen::AngleAxisf aa(M_PI, Eigen::Vector3f(0, 0, 1));
+      Eigen::Quaternionf q(aa);
+      aa = Eigen::AngleAxisf(M_PI, Eigen::Vector3f(0, 1, 0));
+      q *= Eigen::Quaternionf(aa);
+      camera_.setOrientation(q);
+      camera_.setPosition(center - Vector3f(0, 0, 1.5f * root.size));
+      camera_.setTarget(center);
+      view_center_ = center;
+      glewInit();
+
+      CHECK_GLUT_ERROR
+    }
+
+    void
+    keyboard(unsigned char key, int x, int y)
+    {
+      switch (key)
+      {
+        case 'q':
+          quit = true;
+          break;
+        case 's':
+          if (file && cache)
+            std::cout << windowname_ << ": " << file->header->n_points << " points in " << file->header->n_nodes
+                      << " nodes, drew " << points_drawn << (complete ? "" : " (refining)") << ", " << cache->size()
+                      << " nodes cached in " << (cache->bytes >> 20) << " MB, " << cache->loads << " loads, "
+                      << cache->evictions << " evictions" << std::endl;
+          break;
+        default:
+          break;
+      }
+    }
+
+    void
+    destroy()
+    {
+      program.reset();
+      cache.reset();
+    }
+
+    std::string path;
+    float min_spacing;
+    size_t point_budget;
+    int loads_per_frame;
+    size_t cache_bytes;
+
+    boost::shared_ptr<OctreeFile> file;
+    boost::shared_ptr<OctreeCache> cache;
+    boost::shared_ptr<OctreeProgram> program;
+    size_t frames_drawn, points_drawn;
+    bool complete; //every selected node was on the GPU
+    bool quit;
+  };
+
+  struct OctreeDisplay
+  {
+    static void
+    declare_params(tendrils& params)
+    {
+      params.declare<std::string>("window_name", "A name for the window.", "octree.");
+      params.declare<std::string>("file", "An octree built by ecto_gl_octree_build.");
+      params.declare<float>("min_spacing", "Refine until points are at most this many pixels apart.", 1.5f);
+      params.declare<int>("point_budget", "Most points drawn per frame.", 10000000);
+      params.declare<int>("loads_per_frame", "Nodes uploaded per frame while refining.", 16);
+      params.declare<int>("cache_mb", "GPU memory for node buffers, in megabytes.", 512);
+      params.declare<std::string>("layout", "Views of the cloud: single, split, pip or quad.", "single");
+    }
+
+    static void
+    declare_io(const tendrils& params, tendrils& i, tendrils& o)
+    {
+    }
+
+    void
+    configure(const tendrils& p, const tendrils& i, const tendrils& o)
+    {
+      window.reset(new OctreeWindow(p.get<std::string>("window_name"), p.get<std::string>("file")));
+      window->min_spacing = p.get<float>("min_spacing");
+      window->point_budget = p.get<int>("point_budget");
+      window->loads_per_frame = p.get<int>("loads_per_frame");
+      window->cache_bytes = size_t(p.get<int>("cache_mb")) << 20;
+      window->setLayout(p.get<std::string>("layout"));
+    }
+
+    int
+    process(const tendrils&, const tendrils&)
+    {
+      if (window->quit)
+      {
+        ecto_gl::stop();
+        return ecto::QUIT;
+      }
+      ecto_gl::show_window(window);
+      return ecto::OK;
+    }
+
+    boost::shared_ptr<OctreeWindow> window;
+  };
+}
+ECTO_CELL(ecto_gl, ecto_gl::OctreeDisplay, "OctreeDisplay", "An out-of-core viewer for octree files of huge point clouds")
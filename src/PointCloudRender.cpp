@@ -2,7 +2,11 @@
 #include <GL/glew.h>
 
 #include "ecto_gl.hpp"
+#include "cloud.hpp"
+#include "cloud_gl.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <vector>
 #include <sstream>
 
@@ -15,203 +19,321 @@
 
 #include <GL/freeglut.h>
 
+#include <opencv2/core/core.hpp>
+
 namespace ecto_gl
 {
   using Eigen::Vector3f;
   using Eigen::Matrix4f;
 
-  typedef std::vector<uint8_t> RgbData;
-  typedef std::vector<uint16_t> DepthData;
-
-  typedef boost::shared_ptr<RgbData> RgbDataPtr;
-  typedef boost::shared_ptr<DepthData> DepthDataPtr;
-
-  typedef boost::shared_ptr<const RgbData> RgbDataConstPtr;
-  typedef boost::shared_ptr<const DepthData> DepthDataConstPtr;
-
   using ecto::tendrils;
   using ecto::spore;
-  struct CloudProgram
-  {
-    CloudProgram()
-    {
-      static const char vertexShader[] = SHADER_STR(
-          attribute float depth;
-          attribute vec3 rgb;
-          varying vec4 color;
-          uniform mat4 projection_modelview;
-          void main()
-          {
-            float fx = 525.;
-            float fy = 525.;
-            float cx = 640./2.0 - .5;
-            float cy = 480./2.0 - .5;
-
-            float y = gl_VertexID/640;
-            float x = gl_VertexID%640;
-
-            vec4 position;
-            float d = depth / 1000.;
-            position[0] = (x - cx)*d/fx;
-            position[1] = (y - cy)*d/fy;
-            position[2] = d;
-            position[3] = 1;
-
-            color = vec4(rgb[0]/255.,rgb[1]/255.,rgb[2]/255.,1.);
-            gl_Position = projection_modelview*position;
-            gl_PointSize = 2.0;
-          }
-      );
-
-      static const char fragmentShader[] = SHADER_STR(
-          precision mediump float;
-          varying vec4 color;
-          void main()
-          {
-            gl_FragColor = color;
-          };
-      );
-      program.reset(new GlProgram(vertexShader, fragmentShader));
-      projection_modelview = glGetUniformLocation(program->program, "projection_modelview");
-      depthHandle = glGetAttribLocation(program->program, "depth");
-      rgbHandle = glGetAttribLocation(program->program, "rgb");
-
-      CHECK_GLUT_ERROR
-    }
-    boost::shared_ptr<GlProgram> program;
-    GLuint projection_modelview, depthHandle, rgbHandle;
-  };
 
-//  std::vector<float>
-//  fill_uv(int w = 640, int h = 480)
-//  {
-//    std::vector<float> uv(w * h * 2);
-//    float* uvp = uv.data();
-//    for (int v = 0; v < h; v++)
-//      for (int u = 0; u < w; u++)
-//      {
-//        *(uvp++) = u;
-//        *(uvp++) = v;
-//      }
-//    return uv;
-//  }
-
-  struct CloudData: boost::noncopyable
+  /**
+   * The last frames of a moving sensor, each drawn at its own pose. The frames
+   * live in a ring of CloudData slots, so a new frame costs one upload into the
+   * oldest slot's buffers, overwritten in place.
+   */
+  struct CloudHistory: boost::noncopyable
   {
-//    static const size_t PER_UV = 2; //U,V
-//    static const size_t STEP_UV = PER_UV * sizeof(float); // the step from one point start to the next
-
-    static const size_t PER_DEPTH = 1; //depth
-    static const size_t STEP_DEPTH = PER_DEPTH * sizeof(uint16_t); // the step from one point start to the next
-
-    static const size_t PER_RGB = 3; //depth
-    static const size_t STEP_RGB = PER_RGB * sizeof(uint8_t); // the step from one point start to the next
-
-    CloudData()
+    CloudHistory(int length)
         :
-          n(640 * 480),
-          depth_buffer(0),
-          rgb_buffer(0)
+          slots(std::max(length, 1)),
+          next(0),
+          count(0)
     {
+      for (size_t i = 0; i < slots.size(); i++)
+        slots[i].reset(new CloudData);
+    }
 
+    void
+    push(const CloudFrame& f, const DepthConvertProgram* convert)
+    {
+      if (!f.depth || (count && newest()->frame.depth == f.depth))
+        return;
+      slots[next]->setData(f, convert);
+      if (slots[next]->frame.depth != f.depth)
+        return; //dropped as malformed
+      next = (next + 1) % slots.size();
+      count = std::min(count + 1, slots.size());
     }
-    ~CloudData()
+
+    CloudData*
+    newest() const
     {
-      glDeleteBuffers(1, &depth_buffer);
-      glDeleteBuffers(1, &rgb_buffer);
+      return count ? slots[(next + slots.size() - 1) % slots.size()].get() : 0;
+    }
 
-      CHECK_GLUT_ERROR
+    /** Draw newest to oldest, so the newest wins depth ties, with older frames darker down to min_fade. */
+    size_t
+    draw(const CloudProgram& program, const Camera& c, const CloudStyle& style, float min_fade = .2f) const
+    {
+      size_t drawn = 0;
+      for (size_t age = 0; age < count; age++)
+      {
+        const boost::shared_ptr<CloudData>& slot = slots[(next + 2 * slots.size() - 1 - age) % slots.size()];
+        drawn += slot->draw(program, c, style, 1.f - (1.f - min_fade) * age / slots.size());
+      }
+      return drawn;
     }
+
+    /** Bilaterally filter the depth of all frames, each once after its upload. */
     void
-    setDepth(const DepthData& depth)
+    updateFilter(const BilateralProgram& program, int radius, float sigma_space, float sigma_range)
     {
-      if (!glIsBuffer(depth_buffer))
+      for (size_t age = 0; age < count; age++)
+        slots[(next + 2 * slots.size() - 1 - age) % slots.size()]->updateFilter(program, radius, sigma_space,
+                                                                                sigma_range);
+    }
+
+    /** Bring the normal maps of all frames up to date, each computed once after its upload. */
+    void
+    updateNormals(const NormalProgram& program)
+    {
+      for (size_t age = 0; age < count; age++)
+        slots[(next + 2 * slots.size() - 1 - age) % slots.size()]->updateNormals(program);
+    }
+
+    /** Vertices of all frames in the trail, before culling. */
+    size_t
+    vertices() const
+    {
+      size_t n = 0;
+      for (size_t age = 0; age < count; age++)
       {
-        glGenBuffers(1, &depth_buffer);
+        const CloudFrame& f = slots[(next + 2 * slots.size() - 1 - age) % slots.size()]->frame;
+        n += f.depth_width * f.depth_height;
       }
-      glBindBuffer(GL_ARRAY_BUFFER, depth_buffer);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(uint16_t) * depth.size(), depth.data(), GL_DYNAMIC_DRAW);
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-      CHECK_GLUT_ERROR
+      return n;
+    }
 
+    size_t
+    bytesUploaded() const
+    {
+      size_t bytes = 0;
+      for (size_t i = 0; i < slots.size(); i++)
+        bytes += slots[i]->bytes_uploaded;
+      return bytes;
+    }
 
+    size_t
+    framesUploaded() const
+    {
+      size_t frames = 0;
+      for (size_t i = 0; i < slots.size(); i++)
+        frames += slots[i]->frames_uploaded;
+      return frames;
     }
 
-    void
-    setColor(const RgbData& rgb)
+    std::vector<boost::shared_ptr<CloudData> > slots;
+    size_t next, count;
+  };
+
+  /**
+   * Uploads frames on a background thread with its own shared context, so
+   * transfers overlap with drawing. Frames go round a ring of CloudData slots:
+   * the uploader fills a free slot, fences it and publishes it as ready; the
+   * render thread adopts the newest ready slot, waiting on the GPU only if its
+   * fence has not signaled yet, and fences the slot it stops drawing so the
+   * uploader does not overwrite it while still in use.
+   */
+  class CloudUploader: boost::noncopyable
+  {
+  public:
+    static const int N_SLOTS = 3;
+
+    CloudUploader()
+        :
+          context_(SharedContext::create()),
+          ready_(-1),
+          displayed_(-1),
+          bytes_uploaded(0),
+          frames_uploaded(0)
     {
-      if (!glIsBuffer(rgb_buffer))
+      for (int i = 0; i < N_SLOTS; i++)
       {
-        glGenBuffers(1, &rgb_buffer);
+        slots_[i].cloud.reset(new CloudData);
+        slots_[i].ready = 0;
+        slots_[i].released = 0;
       }
-      glBindBuffer(GL_ARRAY_BUFFER, rgb_buffer);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(uint8_t) * rgb.size(), rgb.data(), GL_DYNAMIC_DRAW);
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      thread_ = boost::thread(boost::bind(&CloudUploader::run, this));
+    }
 
-      CHECK_GLUT_ERROR
+    ~CloudUploader()
+    {
+      thread_.interrupt();
+      thread_.join();
+      for (int i = 0; i < N_SLOTS; i++)
+      {
+        glDeleteSync(slots_[i].ready);
+        glDeleteSync(slots_[i].released);
+      }
     }
+
+    /** Queue a frame for upload, replacing any frame that has not been picked up yet. */
     void
-    draw(const Camera& c)
+    push(const CloudFrame& f)
     {
-      glViewport(0, 0, c.vpWidth(), c.vpHeight());
-      if(!glIsProgram(program.program->program))
+      boost::mutex::scoped_lock lock(mtx_);
+      if (!f.depth || f.depth == pushed_depth_)
+        return;
+      pending_ = f;
+      pushed_depth_ = f.depth;
+      cond_.notify_one();
+    }
+
+    /**
+     * Render thread: switch to the newest uploaded frame if there is one, and
+     * return the cloud to draw, or 0 before the first frame arrives.
+     */
+    CloudData*
+    acquire()
+    {
+      GLsync ready = 0;
       {
-        std::cout << "not a program" << std::endl;
-        program = CloudProgram();
+        boost::mutex::scoped_lock lock(mtx_);
+        if (ready_ >= 0)
+        {
+          if (displayed_ >= 0)
+            slots_[displayed_].released = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+          displayed_ = ready_;
+          ready_ = -1;
+          std::swap(ready, slots_[displayed_].ready);
+        }
       }
-      glUseProgram(program.program->program);
-      if (glIsBuffer(depth_buffer))
+      if (ready)
       {
-        glEnableVertexAttribArray(program.depthHandle);
-        glBindBuffer(GL_ARRAY_BUFFER, depth_buffer);
-        glVertexAttribPointer(program.depthHandle, PER_DEPTH, GL_UNSIGNED_SHORT, GL_FALSE, STEP_DEPTH, (void*) 0);
+        glWaitSync(ready, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(ready);
       }
-      CHECK_GLUT_ERROR
+      return displayed_ >= 0 ? slots_[displayed_].cloud.get() : 0;
+    }
 
-      if (glIsBuffer(rgb_buffer))
+  private:
+    struct Slot
+    {
+      boost::shared_ptr<CloudData> cloud;
+      GLsync ready, released;
+    };
+
+    void
+    run()
+    {
+      context_->makeCurrent();
+      try
+      {
+        while (true)
+        {
+          CloudFrame f;
+          int slot = -1;
+          {
+            boost::mutex::scoped_lock lock(mtx_);
+            while (!pending_.depth)
+              cond_.wait(lock);
+            std::swap(f, pending_);
+            for (int i = 0; i < N_SLOTS && slot < 0; i++)
+              if (i != ready_ && i != displayed_)
+                slot = i;
+          }
+          upload(slots_[slot], f);
+          boost::mutex::scoped_lock lock(mtx_);
+          if (ready_ >= 0)
+          {
+            //never drawn, so it can be reused without waiting.
+            glDeleteSync(slots_[ready_].ready);
+            slots_[ready_].ready = 0;
+          }
+          ready_ = slot;
+        }
+      } catch (const boost::thread_interrupted&)
       {
-        glEnableVertexAttribArray(program.rgbHandle);
-        glBindBuffer(GL_ARRAY_BUFFER, rgb_buffer);
-        glVertexAttribPointer(program.rgbHandle, PER_RGB, GL_UNSIGNED_BYTE, GL_FALSE, STEP_RGB, (void*) 0);
       }
-      CHECK_GLUT_ERROR
+      convert_.reset();
+      context_->doneCurrent();
+    }
 
-      Matrix4f p = c.projectionMatrix() * c.viewMatrix().matrix();
-      glUniformMatrix4fv(program.projection_modelview, 1, false, p.data());
+    void
+    upload(Slot& slot, const CloudFrame& f)
+    {
+      if (slot.released)
+      {
+        while (glClientWaitSync(slot.released, 0, 1000000) == GL_TIMEOUT_EXPIRED)
+          boost::this_thread::interruption_point();
+        glDeleteSync(slot.released);
+        slot.released = 0;
+      }
+      //the uploader is one per share group, and so is its program.
+      if (f.depth_format != DEPTH_MILLIMETERS && !convert_)
+        convert_.reset(new DepthConvertProgram);
+      slot.cloud->setData(f, convert_.get());
+      slot.ready = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      glFlush();
+      bytes_uploaded += uploadBytes(f);
+      ++frames_uploaded;
+    }
 
-      CHECK_GLUT_ERROR
+    SharedContext::ptr context_;
+    boost::shared_ptr<DepthConvertProgram> convert_;
+    boost::thread thread_;
+    boost::mutex mtx_;
+    boost::condition_variable cond_;
+    Slot slots_[N_SLOTS];
+    int ready_, displayed_;
+    CloudFrame pending_;
+    DepthDataConstPtr pushed_depth_;
 
-      glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
-      glDrawArrays(GL_POINTS, 0, 2 * n);
-      CHECK_GLUT_ERROR
-      glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
-      glUseProgram(0);
-
-      CHECK_GLUT_ERROR
-    }
-    std::vector<float> uvs;
-    int n;
-    GLuint uv_buffer, depth_buffer, rgb_buffer;
-    CloudProgram program;
+  public:
+    size_t bytes_uploaded, frames_uploaded;
   };
 
   class CloudWindow: public GLWindow
   {
   public:
-    CloudWindow(const std::string window_name)
+    CloudWindow(const std::string window_name, const std::string& share_group = std::string(), bool async_upload =
+                    false)
         :
-          GLWindow(window_name),
+          GLWindow(window_name, share_group),
+          async_upload(async_upload),
+          history_length(1),
+          lambert(false),
+          output_normals(false),
+          bilateral_kernel(0),
+          bilateral_sigma_space(3),
+          bilateral_sigma_range(.03f),
+          output_filtered_depth(false),
+          temporal_alpha(0),
+          temporal_motion(.03f),
+          max_jump(0),
+          mesh(false),
+          mesh_step(2),
+          mesh_max_edge(.05f),
+          color(CloudProgram::RGB),
+          up(0, -1, 0),
+          color_min(0),
+          color_max(0),
+          find_plane(false),
+          plane_threshold(.015f),
+          draw_query(0),
+          query_pending(false),
+          timing(false),
+          frames_drawn(0),
+          vertices_drawn(0),
+          vertices_total(0),
           quit(false)
     {
     }
     void
-    setData(const RgbDataConstPtr& c, const DepthDataConstPtr& d)
+    setData(const CloudFrame& f)
     {
       boost::mutex::scoped_lock lock(mtx);
-      depth = d;
-      rgb = c;
+      arrival = boost::posix_time::microsec_clock::universal_time();
+      arrival_depth = f.depth;
+      if (uploader)
+      {
+        uploader->push(f);
+        return;
+      }
+      frame = f;
     }
 
     virtual void
@@ -222,25 +344,165 @@ namespace ecto_gl
       glClearColor(0.0f, 0.0f, 0.0f, 1.f);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-      if (!cloud_raw.get())
-        cloud_raw.reset(new CloudData);
-
-      if (depth)
+      //the program and the uploaded cloud live in the share group, so every
+      //window of the group draws from the same buffers.
+      if (!program)
+        program = share_group_->resource<CloudProgram>("cloud_program");
+      if (async_upload)
+      {
+        if (!uploader)
+          startUploader();
+      }
+      CloudData* cloud = 0;
+      if (history_length > 1)
+      {
+        //a trail keeps its own ring of frames per window.
+        if (!history)
+          history.reset(new CloudHistory(history_length));
+        boost::mutex::scoped_lock lock(mtx);
+        history->push(frame, convertProgram());
+        cloud = history->newest();
+      }
+      else if (uploader)
       {
+        cloud = uploader->acquire();
+      }
+      else
+      {
+        if (!cloud_raw)
+          cloud_raw = share_group_->resource<CloudData>("cloud");
         boost::mutex::scoped_lock lock(mtx);
-        cloud_raw->setDepth(*depth);
-        depth.reset();
-        cloud_raw->setColor(*rgb);
-        rgb.reset();
+        cloud_raw->setData(frame, convertProgram());
+        cloud = cloud_raw.get();
+      }
+      if (cloud && bilateral_kernel > 1)
+      {
+        //filtered in place, before anything else reads the depth.
+        if (!bilateral_program)
+          bilateral_program = share_group_->resource<BilateralProgram>("bilateral_program");
+        if (history)
+          history->updateFilter(*bilateral_program, bilateral_kernel / 2, bilateral_sigma_space,
+                                bilateral_sigma_range);
+        else
+          cloud->updateFilter(*bilateral_program, bilateral_kernel / 2, bilateral_sigma_space, bilateral_sigma_range);
+        if (output_filtered_depth)
+          readPass(cloud->filtered, cloud->filtered_depth, filtered_read, filtered_readback, GL_RED_INTEGER,
+                   GL_UNSIGNED_SHORT, CV_16UC1, filtered_depth);
+      }
+      if (cloud && temporal_alpha > 0 && temporal_alpha < 1)
+      {
+        //the average belongs to the stream: per window for a trail, else shared with the cloud.
+        if (!temporal_program)
+          temporal_program = share_group_->resource<TemporalProgram>("temporal_program");
+        if (!temporal)
+          temporal = history ? boost::shared_ptr<TemporalFilter>(new TemporalFilter) :
+                               share_group_->resource<TemporalFilter>("temporal_filter");
+        temporal->apply(*cloud, *temporal_program, temporal_alpha, temporal_motion);
       }
-      cloud_raw->draw(camera_);
+      if (cloud && (lambert || output_normals || color == CloudProgram::NORMAL))
+      {
+        if (!normal_program)
+          normal_program = share_group_->resource<NormalProgram>("normal_program");
+        if (history)
+          history->updateNormals(*normal_program);
+        else
+          cloud->updateNormals(*normal_program);
+        if (output_normals)
+          readPass(cloud->normals, cloud->normals_depth, normals_read, normals_readback, GL_RGB, GL_FLOAT, CV_32FC3,
+                   normals);
+      }
+      if (cloud && find_plane)
+      {
+        //only the newest frame, which is what the plane outputs describe.
+        if (!plane_program)
+          plane_program = share_group_->resource<PlaneProgram>("plane_program");
+        cloud->updatePlane(*plane_program, plane_threshold);
+        readPass(cloud->plane_fit.plane, cloud->plane_depth, plane_read, plane_readback, GL_RGBA, GL_FLOAT, CV_32FC4,
+                 plane_texels);
+        readPass(cloud->plane_fit.mask, cloud->plane_depth, plane_mask_read, plane_mask_readback, GL_RED,
+                 GL_UNSIGNED_BYTE, CV_8UC1, plane_mask);
+      }
+      if (cloud)
+      {
+        CloudStyle style;
+        style.shade = lambert;
+        style.plane_threshold = find_plane ? plane_threshold : 0;
+        style.max_jump = max_jump;
+        style.color = color;
+        style.up = up;
+        if (color == CloudProgram::DEPTH || color == CloudProgram::HEIGHT)
+        {
+          if (color_min < color_max)
+            style.color_range = Eigen::Vector2f(color_min, color_max);
+          else
+          {
+            //ranged on the newest frame, so a trail shares its colors.
+            if (!range_program)
+              range_program = share_group_->resource<RangeProgram>("range_program");
+            if (!value_range)
+              value_range.reset(new ValueRange);
+            value_range->update(*cloud, *range_program, cloud->colorPlane(color, up));
+            style.color_range = value_range->range;
+          }
+        }
+        const CloudProgram* draw_program = program.get();
+        if (mesh)
+        {
+          if (!mesh_program)
+            mesh_program = share_group_->resource<CloudMeshProgram>("cloud_mesh_program");
+          draw_program = mesh_program.get();
+          style.mesh_step = std::max(mesh_step, 1);
+          style.max_edge = mesh_max_edge;
+        }
+        //every view draws the same uploaded cloud, only the camera changes.
+        beginDrawTimer();
+        std::vector<Camera*> cameras = this->cameras();
+        for (size_t i = 0; i < cameras.size(); i++)
+        {
+          if (cameras.size() > 1)
+            beginView(*cameras[i]);
+          if (history)
+          {
+            vertices_drawn += history->draw(*draw_program, *cameras[i], style);
+            vertices_total += history->vertices();
+          }
+          else
+          {
+            vertices_drawn += cloud->draw(*draw_program, *cameras[i], style);
+            vertices_total += cloud->frame.depth_width * cloud->frame.depth_height;
+          }
+        }
+        endDrawTimer();
+        boost::mutex::scoped_lock lock(mtx);
+        if (cloud->frame.depth && cloud->frame.depth == arrival_depth)
+        {
+          //first frame showing the newest data.
+          frameShowsData(arrival);
+          arrival_depth.reset();
+        }
+      }
+      ++frames_drawn;
 
       CHECK_GLUT_ERROR
     }
     virtual void
     init()
     {
+      program.reset();
+      mesh_program.reset();
+      normal_program.reset();
+      bilateral_program.reset();
+      temporal_program.reset();
+      temporal.reset();
+      range_program.reset();
+      value_range.reset();
+      plane_program.reset();
+      convert_program.reset();
       cloud_raw.reset();
+      history.reset();
+      resetUploader();
+      normals_readback.pbo = filtered_readback.pbo = plane_readback.pbo = plane_mask_readback.pbo = 0;
+      normals_readback.fence = filtered_readback.fence = plane_readback.fence = plane_mask_readback.fence = 0;
       /* Use depth buffering for hidden surface elimination. */
       camera_.setFovY(3.14f / 4);
       camera_.setPosition(Vector3f(0, 0, -1));
@@ -250,16 +512,112 @@ namespace ecto_gl
       aa = Eigen::AngleAxisf(M_PI, Eigen::Vector3f(0, 1, 0));
       q *= Eigen::Quaternionf(aa);
       camera_.setOrientation(q);
+      //extra views orbit a point at typical sensor range.
+      view_center_ = Vector3f(0, 0, 2);
       glewInit();
+      if (GLEW_ARB_timer_query)
+        glGenQueries(1, &draw_query);
+      query_pending = false;
 
       CHECK_GLUT_ERROR
     }
 
+    /**
+     * Time the draw calls on the GPU. The result is picked up a few frames
+     * later, once available, so reading it never stalls the pipeline.
+     */
+    void
+    beginDrawTimer()
+    {
+      if (!draw_query)
+        return;
+      if (query_pending)
+      {
+        GLint available = 0;
+        glGetQueryObjectiv(draw_query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+          return;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(draw_query, GL_QUERY_RESULT, &ns);
+        draw_ms.add(ns / 1e6);
+        query_pending = false;
+      }
+      glBeginQuery(GL_TIME_ELAPSED, draw_query);
+      query_pending = true;
+      timing = true;
+    }
+
+    void
+    endDrawTimer()
+    {
+      if (!timing)
+        return;
+      glEndQuery(GL_TIME_ELAPSED);
+      timing = false;
+    }
+
     void
     timerfunc(int)
     {
     }
 
+    /**
+     * Read a pass of the cloud into a pixel buffer, if it was computed from a
+     * frame not read yet, and into out the one read a frame or more ago.
+     */
+    void
+    readPass(const PixelPass& pass, const DepthDataConstPtr& depth, DepthDataConstPtr& read, PassReadback& readback,
+             GLenum format, GLenum type, int mat_type, cv::Mat& out)
+    {
+      cv::Mat mat;
+      if (readback.finish(mat))
+      {
+        boost::mutex::scoped_lock lock(mtx);
+        out = mat;
+      }
+      if (depth && depth != read && readback.start(pass, format, type, mat_type))
+        read = depth;
+
+      CHECK_GLUT_ERROR
+    }
+
+    /** The newest normal map read back, CV_32FC3 at the depth resolution, empty until there is one. */
+    cv::Mat
+    latestNormals()
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      return normals;
+    }
+
+    /** The newest filtered depth read back, CV_16UC1 in millimeters, empty until there is one. */
+    cv::Mat
+    latestFilteredDepth()
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      return filtered_depth;
+    }
+
+    /** The newest dominant plane read back as a 4x1 CV_32F a, b, c, d, empty until there is one. */
+    cv::Mat
+    latestPlane()
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      if (plane_texels.empty() || !(plane_texels.ptr<float>()[0] || plane_texels.ptr<float>()[1]
+          || plane_texels.ptr<float>()[2]))
+        return cv::Mat();
+      cv::Mat plane(4, 1, CV_32F);
+      std::memcpy(plane.data, plane_texels.data, 4 * sizeof(float));
+      return plane;
+    }
+
+    /** The newest inlier mask of the dominant plane, CV_8UC1 at the depth resolution, 255 at its points. */
+    cv::Mat
+    latestPlaneMask()
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      return plane_mask;
+    }
+
     void
     keyboard(unsigned char key, int x, int y)
     {
@@ -268,30 +626,310 @@ namespace ecto_gl
         case 'q':
           quit = true;
           break;
+        case 's':
+          printStats(std::cout);
+          break;
+        case 'l':
+          lambert = !lambert;
+          break;
+        case 'm':
+          mesh = !mesh;
+          break;
+        case 'c':
+        {
+          //process() reads it to tell if frames need a color image.
+          boost::mutex::scoped_lock lock(mtx);
+          color = (color + 1) % 4;
+          break;
+        }
+        case 'p':
+          find_plane = !find_plane;
+          break;
+        case 'v':
+        {
+          static const char* layouts[] =
+          { "single", "split", "pip", "quad" };
+          int next = (std::find(layouts, layouts + 4, layout_) - layouts + 1) % 4;
+          setLayout(layouts[next]);
+          break;
+        }
         default:
           break;
       }
       return;
     }
 
+    void
+    printStats(std::ostream& out)
+    {
+      size_t frames_uploaded = 0, bytes_uploaded = 0;
+      if (cloud_raw)
+      {
+        frames_uploaded = cloud_raw->frames_uploaded;
+        bytes_uploaded = cloud_raw->bytes_uploaded;
+      }
+      if (history)
+      {
+        frames_uploaded = history->framesUploaded();
+        bytes_uploaded = history->bytesUploaded();
+      }
+      if (uploader)
+      {
+        frames_uploaded = uploader->frames_uploaded;
+        bytes_uploaded = uploader->bytes_uploaded;
+      }
+      out << windowname_ << ": drew " << frames_drawn << " frames, uploaded " << frames_uploaded << " frames";
+      if (async_upload)
+        out << " on the upload thread";
+      if (frames_uploaded)
+        out << " at " << bytes_uploaded / frames_uploaded << " bytes/frame";
+      if (!share_group_->name_.empty())
+        out << " (shared by " << share_group_->members_ << " windows of group '" << share_group_->name_ << "')";
+      out << std::endl;
+      out << "  data to frame latency [ms]: " << latency_ms_ << ", swap interval " << swap_interval_
+          << ", max frames in flight " << max_frames_in_flight_ << std::endl;
+      if (vertices_total)
+        out << "  frustum culling drew " << 100. * vertices_drawn / vertices_total << "% of " << vertices_total
+            << " vertices" << std::endl;
+      if (draw_ms.count)
+      {
+        out << "  gpu draw time [ms]: " << draw_ms;
+        if (history)
+          out << " for a trail of " << history->count << " of " << history_length << " frames";
+        out << std::endl;
+      }
+    }
+
     void
     destroy()
     {
-//      cloud_raw.reset();
+      //the group releases the shared resources once its last window goes away.
+      program.reset();
+      mesh_program.reset();
+      normal_program.reset();
+      bilateral_program.reset();
+      temporal_program.reset();
+      temporal.reset();
+      range_program.reset();
+      value_range.reset();
+      plane_program.reset();
+      convert_program.reset();
+      cloud_raw.reset();
+      history.reset();
+      resetUploader();
+      glDeleteQueries(1, &draw_query);
+      draw_query = 0;
+      normals_readback.release();
+      filtered_readback.release();
+      plane_readback.release();
+      plane_mask_readback.release();
     }
 
-    std::auto_ptr<CloudData> cloud_raw;
-    DepthDataConstPtr depth;
-    RgbDataConstPtr rgb;
+    /** The share group's program for frames in another depth format than millimeters, called with mtx held. */
+    const DepthConvertProgram*
+    convertProgram()
+    {
+      if (frame.depth_format == DEPTH_MILLIMETERS)
+        return 0;
+      if (!convert_program)
+        convert_program = share_group_->resource<DepthConvertProgram>("depth_convert_program");
+      return convert_program.get();
+    }
+
+    void
+    startUploader()
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      try
+      {
+        uploader = share_group_->resource<CloudUploader>("cloud_uploader");
+      } catch (const std::exception& e)
+      {
+        std::cerr << "Falling back to uploads on the render thread: " << e.what() << std::endl;
+        async_upload = false;
+        return;
+      }
+      uploader->push(frame);
+      frame = CloudFrame();
+    }
+
+    void
+    resetUploader()
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      uploader.reset();
+    }
+
+    boost::shared_ptr<CloudProgram> program;
+    boost::shared_ptr<CloudMeshProgram> mesh_program;
+    boost::shared_ptr<NormalProgram> normal_program;
+    boost::shared_ptr<BilateralProgram> bilateral_program;
+    boost::shared_ptr<TemporalProgram> temporal_program;
+    boost::shared_ptr<TemporalFilter> temporal;
+    boost::shared_ptr<RangeProgram> range_program;
+    boost::shared_ptr<ValueRange> value_range;
+    boost::shared_ptr<PlaneProgram> plane_program;
+    boost::shared_ptr<DepthConvertProgram> convert_program;
+    boost::shared_ptr<CloudData> cloud_raw;
+    boost::shared_ptr<CloudUploader> uploader;
+    boost::shared_ptr<CloudHistory> history;
+    bool async_upload;
+    int history_length; //frames in the trail, 1 for the newest frame only
+    bool lambert; //shade by the normal map, toggled with l
+    bool output_normals; //read the normal map back into normals
+    int bilateral_kernel; //side of the bilateral filter window in pixels, 0 for no filtering
+    float bilateral_sigma_space, bilateral_sigma_range; //in pixels and meters
+    bool output_filtered_depth; //read the filtered depth back into filtered_depth
+    float temporal_alpha, temporal_motion; //weight of a new frame in the depth average, 0 for none, and meters
+    float max_jump; //drop flying pixels this much deeper or shallower than a neighbor, relative, 0 for none
+    bool mesh; //draw a surface instead of points, toggled with m
+    int mesh_step; //pixels between mesh vertices
+    float mesh_max_edge; //longest mesh edge, relative to its depth
+    int color; //a CloudProgram::ColorMode, cycled with c
+    Vector3f up; //the world direction HEIGHT colors along
+    float color_min, color_max; //meters at the ends of the colormap, auto-ranged unless min < max
+    bool find_plane; //fit and highlight the dominant plane, toggled with p
+    float plane_threshold; //meters from the plane of its inliers
+    PassReadback normals_readback, filtered_readback, plane_readback, plane_mask_readback;
+    DepthDataConstPtr normals_read, filtered_read, plane_read, plane_mask_read; //the frames last read back
+    cv::Mat normals, filtered_depth, plane_texels, plane_mask;
+    GLuint draw_query;
+    bool query_pending, timing;
+    Stat draw_ms;
+    CloudFrame frame;
+    DepthDataConstPtr arrival_depth; //the newest frame not shown yet, and when it arrived.
+    boost::posix_time::ptime arrival;
     boost::mutex mtx;
+    size_t frames_drawn;
+    size_t vertices_drawn, vertices_total; //over all frames and views, before and after culling
     bool quit;
   };
+  /** The CloudProgram::ColorMode named "rgb", "depth", "height" or "normal". */
+  inline int
+  parseColorMode(const std::string& name)
+  {
+    static const char* names[] =
+    { "rgb", "depth", "height", "normal" };
+    for (int i = 0; i < 4; i++)
+      if (name == names[i])
+        return i;
+    throw std::runtime_error("Unknown color " + name + ", expected rgb, depth, height or normal.");
+  }
+
+  /** The unit vector named "x", "y" or "z", with an optional leading minus sign. */
+  inline Vector3f
+  parseAxis(const std::string& name)
+  {
+    std::string axis = name.substr(name.size() > 1 && name[0] == '-');
+    if (axis != "x" && axis != "y" && axis != "z")
+      throw std::runtime_error("Unknown axis " + name + ", expected x, y or z, optionally with a minus sign.");
+    Vector3f v = Vector3f::Unit(axis[0] - 'x');
+    return name[0] == '-' ? Vector3f(-v) : v;
+  }
+
   struct PointCloudDisplay
   {
     static void
     declare_params(tendrils& params)
     {
       params.declare<std::string>("window_name", "A name for the window.", "cloudy.");
+      params.declare<std::string>("share_group",
+                                  "Windows with the same share group name share one GL context, "
+                                  "so a frame is uploaded once and drawn by all of them.",
+                                  "");
+      params.declare<bool>("async_upload",
+                           "Upload frames on a background thread with a shared context, overlapping "
+                           "transfers with drawing.",
+                           false);
+      params.declare<bool>("inline_render",
+                           "Upload, draw and swap synchronously in process() instead of on the glut thread. "
+                           "For batch and benchmarking plasms; can not be mixed with threaded windows.",
+                           false);
+      params.declare<int>("swap_interval",
+                          "Swap interval for the window: 0 disables vsync, 1 syncs every refresh, -1 keeps the driver default.",
+                          -1);
+      params.declare<int>("max_frames_in_flight",
+                          "How many frames may be queued on the GPU before rendering blocks; 0 for no limit.", 0);
+      params.declare<bool>("low_latency",
+                           "Minimize data to photon time: no vsync and a single frame in flight. "
+                           "Overrides swap_interval and max_frames_in_flight.",
+                           false);
+      params.declare<std::string>("layout",
+                                  "Views of the cloud: single, split (with a side view), pip (with a top view inset) "
+                                  "or quad (with front, top and side views). Press v to cycle.",
+                                  "single");
+      params.declare<int>("history_length",
+                          "Draw a trail of this many recent frames, each at its own pose from R and T and darker "
+                          "with age. Uploads on the render thread.",
+                          1);
+      params.declare<bool>("readback",
+                           "Read every rendered frame back into the image output. Always on with the headless backend.",
+                           false);
+      params.declare<bool>("lambert",
+                           "Shade the points by normals computed on the GPU from the depth, lit from the viewer. "
+                           "Press l to toggle.",
+                           false);
+      params.declare<bool>("output_normals", "Compute the normal map on the GPU and read it back into normals.",
+                           false);
+      params.declare<int>("bilateral_kernel",
+                          "Side in pixels of an edge preserving bilateral filter run over the depth on the GPU "
+                          "before it is unprojected; 0 for none. Odd sizes up to 65.",
+                          0);
+      params.declare<float>("bilateral_sigma_space", "Spatial sigma of the bilateral filter, in pixels.", 3);
+      params.declare<float>("bilateral_sigma_range", "Range sigma of the bilateral filter, in meters.", .03f);
+      params.declare<bool>("output_filtered_depth",
+                           "Read the bilaterally filtered depth back into filtered_depth.", false);
+      params.declare<float>("temporal_alpha",
+                            "Average the depth of a static sensor over time on the GPU, weighting each new frame by "
+                            "this; 0 for no averaging.",
+                            0);
+      params.declare<float>("temporal_motion",
+                            "Depth change in meters beyond which a pixel of the average follows a new frame at once.",
+                            .03f);
+      params.declare<float>("max_jump",
+                            "Drop flying pixels at depth edges: points whose depth differs from a neighbor's by more "
+                            "than this fraction of their own, such as 0.04. 0 draws every point.",
+                            0);
+      params.declare<bool>("mesh",
+                           "Draw the depth grid as a triangle mesh instead of points, for solid surfaces. "
+                           "Press m to toggle.",
+                           false);
+      params.declare<int>("mesh_step", "Pixels between mesh vertices: 1 for full resolution, 2 for half.", 2);
+      params.declare<float>("mesh_max_edge",
+                            "Leave out mesh triangles with an edge longer than this fraction of its depth, so "
+                            "separate surfaces are not joined.",
+                            .05f);
+      params.declare<bool>("kinect_calibration",
+                           "For a Kinect running with registration=False: typical calibration of its depth and "
+                           "color cameras wherever depth_K, image_K, image_R and image_T are empty, so colors are "
+                           "registered on the GPU. Only as good as the unit is typical; the device's own "
+                           "registration or the unit's calibration is exact.",
+                           false);
+      params.declare<std::string>("depth_format",
+                                  "How depth is given: millimeters (uint16 in depth_buffer), meters (float in "
+                                  "depth_meters, as from time of flight cameras) or disparity (raw 11 bit Kinect "
+                                  "disparity in depth_buffer). Converted to millimeters on the GPU.",
+                                  "millimeters");
+      params.declare<std::string>("color",
+                                  "Color the points by the color image (rgb), by a colormap of their depth or of their "
+                                  "height along height_axis (depth, height), or by their normal (normal). All but rgb "
+                                  "work without image_buffer. Press c to cycle.",
+                                  "rgb");
+      params.declare<std::string>("height_axis",
+                                  "The world axis height is measured along: x, y or z, with a minus sign for the "
+                                  "negative direction. -y is up for a camera at the origin.",
+                                  "-y");
+      params.declare<float>("color_range_min", "Meters of depth or height at the start of the colormap.", 0);
+      params.declare<float>("color_range_max",
+                            "Meters at the end of the colormap. Not above color_range_min, the range follows each "
+                            "frame's nearest and farthest points, found on the GPU.",
+                            0);
+      params.declare<bool>("find_plane",
+                           "Find the dominant plane of each frame, such as a table top, by RANSAC on the GPU, "
+                           "highlight its points and read it back into plane and plane_mask. Press p to toggle.",
+                           false);
+      params.declare<float>("plane_threshold", "Largest distance in meters of a point from the plane to be on it.",
+                            .015f);
     }
 
     static void
@@ -301,9 +939,32 @@ namespace ecto_gl
       i.declare<int>("depth_height", "Depth frame height.");
       i.declare<int>("image_width", "Image frame width.");
       i.declare<int>("image_height", "Image frame height.");
-      i.declare<int>("image_channels", "Number of image channels.");
+      i.declare<int>("image_channels", "Number of image channels: 1 (gray), 3 (RGB) or 4 (RGBA).");
       i.declare<DepthDataConstPtr>("depth_buffer");
-      i.declare<RgbDataConstPtr>("image_buffer");
+      i.declare<DepthMetersDataConstPtr>("depth_meters", "Depth in float meters, with depth_format meters.");
+      i.declare<RgbDataConstPtr>("image_buffer", "The color image, at its own resolution; it need not match the depth.");
+      i.declare<cv::Mat>("depth_K", "3x3 depth camera matrix; empty for Kinect defaults at the depth resolution.");
+      i.declare<cv::Mat>("image_K",
+                         "3x3 color camera matrix; empty for the depth intrinsics scaled to the image resolution.");
+      i.declare<cv::Mat>("image_R",
+                         "Optional 3x3 rotation from the depth to the color camera frame, for depth not registered "
+                         "to the color image. Colors are then registered on the GPU.");
+      i.declare<cv::Mat>("image_T", "Optional translation from the depth to the color camera frame, in meters.");
+      i.declare<cv::Mat>("R", "Optional 3x3 rotation of the depth camera in the world.");
+      i.declare<cv::Mat>("T", "Optional translation of the depth camera in the world.");
+      o.declare<cv::Mat>("image", "The last rendered view, read back from the GPU as BGR.");
+      o.declare<cv::Mat>("normals",
+                         "With output_normals, a CV_32FC3 normal per depth pixel in the depth camera frame, facing "
+                         "the camera, zero where there is none. A frame or two behind the input.");
+      o.declare<cv::Mat>("filtered_depth",
+                         "With output_filtered_depth, the depth after the bilateral filter, as CV_16UC1 "
+                         "millimeters. A frame or two behind the input.");
+      o.declare<cv::Mat>("plane",
+                         "With find_plane, the dominant plane as a 4x1 CV_32F a, b, c, d with ax + by + cz + d = 0 "
+                         "in the depth camera frame in meters, the camera on the positive side. Empty until one is "
+                         "found, a frame or two behind the input.");
+      o.declare<cv::Mat>("plane_mask",
+                         "With find_plane, a CV_8UC1 mask at the depth resolution, 255 at the plane's points.");
     }
 
     void
@@ -314,20 +975,115 @@ namespace ecto_gl
       image_width = i["image_width"];
       image_height = i["image_height"];
       image_channels = i["image_channels"];
+      depth_K = i["depth_K"];
+      image_K = i["image_K"];
+      image_R = i["image_R"];
+      image_T = i["image_T"];
+      R = i["R"];
+      T = i["T"];
+      history_length = p["history_length"];
       image_buffer = i["image_buffer"];
       depth_buffer = i["depth_buffer"];
+      depth_meters = i["depth_meters"];
       window_name = p["window_name"];
+      share_group = p["share_group"];
+      async_upload = p["async_upload"];
+      inline_render = p["inline_render"];
+      readback = p["readback"];
+      swap_interval = p["swap_interval"];
+      max_frames_in_flight = p["max_frames_in_flight"];
+      low_latency = p["low_latency"];
+      layout = p["layout"];
+      lambert = p["lambert"];
+      output_normals = p["output_normals"];
+      bilateral_kernel = p["bilateral_kernel"];
+      bilateral_sigma_space = p["bilateral_sigma_space"];
+      bilateral_sigma_range = p["bilateral_sigma_range"];
+      output_filtered_depth = p["output_filtered_depth"];
+      temporal_alpha = p["temporal_alpha"];
+      temporal_motion = p["temporal_motion"];
+      max_jump = p["max_jump"];
+      mesh = p["mesh"];
+      mesh_step = p["mesh_step"];
+      mesh_max_edge = p["mesh_max_edge"];
+      kinect_calibration = p["kinect_calibration"];
+      depth_format = parseDepthFormat(p.get<std::string>("depth_format"));
+      color = parseColorMode(p.get<std::string>("color"));
+      up = parseAxis(p.get<std::string>("height_axis"));
+      color_range_min = p["color_range_min"];
+      color_range_max = p["color_range_max"];
+      find_plane = p["find_plane"];
+      plane_threshold = p["plane_threshold"];
+      image = o["image"];
+      normals = o["normals"];
+      filtered_depth = o["filtered_depth"];
+      plane = o["plane"];
+      plane_mask = o["plane_mask"];
     }
 
     int
     process(const tendrils&, const tendrils&)
     {
-      DepthDataConstPtr db = *depth_buffer;
+      DepthDataConstPtr db = depth_format == DEPTH_METERS ? meters_identity(*depth_meters) : *depth_buffer;
       RgbDataConstPtr cb = *image_buffer;
 
       if (!window)
       {
-        window.reset(new CloudWindow(*window_name));
+        //the upload thread buys nothing when drawing happens right here.
+        window.reset(new CloudWindow(*window_name, *share_group,
+                                     *async_upload && !*inline_render && *history_length <= 1));
+        window->history_length = *history_length;
+        window->readback_ = *readback;
+        window->swap_interval_ = *swap_interval;
+        window->max_frames_in_flight_ = *max_frames_in_flight;
+        if (*low_latency)
+          window->setLowLatency();
+        window->setLayout(*layout);
+        window->lambert = *lambert;
+        window->output_normals = *output_normals;
+        window->bilateral_kernel = *bilateral_kernel;
+        window->bilateral_sigma_space = *bilateral_sigma_space;
+        window->bilateral_sigma_range = *bilateral_sigma_range;
+        window->output_filtered_depth = *output_filtered_depth;
+        window->temporal_alpha = *temporal_alpha;
+        window->temporal_motion = *temporal_motion;
+        window->max_jump = *max_jump;
+        window->mesh = *mesh;
+        window->mesh_step = *mesh_step;
+        window->mesh_max_edge = *mesh_max_edge;
+        window->color = color;
+        window->up = up;
+        window->color_min = *color_range_min;
+        window->color_max = *color_range_max;
+        window->find_plane = *find_plane;
+        window->plane_threshold = *plane_threshold;
+      }
+
+      CloudFrame frame = makeFrame(cb, db);
+      //the color modes other than rgb draw without a color image.
+      bool needs_rgb;
+      {
+        boost::mutex::scoped_lock lock(window->mtx);
+        needs_rgb = window->color == CloudProgram::RGB;
+      }
+      bool ready = db && (cb || !needs_rgb);
+      if (*inline_render)
+      {
+        if (ready)
+          window->setData(frame);
+        ecto_gl::render_inline(window);
+        outputFrame();
+        if (*output_normals)
+          *normals = window->latestNormals();
+        if (*output_filtered_depth)
+          *filtered_depth = window->latestFilteredDepth();
+        outputPlane();
+        if (window->quit)
+        {
+          ecto_gl::destroy_window(window);
+          return ecto::QUIT;
+        }
+        return ecto::OK;
       }
 
       if (window->quit)
@@ -337,19 +1093,78 @@ namespace ecto_gl
       }
 
       ecto_gl::show_window(window);
-      if (cb && db)
+      if (ready)
       {
-        window->setData(cb, db);
+        window->setData(frame);
       }
+      outputFrame();
+      if (*output_normals)
+        *normals = window->latestNormals();
+      if (*output_filtered_depth)
+        *filtered_depth = window->latestFilteredDepth();
+      outputPlane();
       return ecto::OK;
     }
 
+    void
+    outputPlane()
+    {
+      if (!*find_plane)
+        return;
+      *plane = window->latestPlane();
+      *plane_mask = window->latestPlaneMask();
+    }
+
+    /** The frame with its sizes, calibration and pose. */
+    CloudFrame
+    makeFrame(const RgbDataConstPtr& cb, const DepthDataConstPtr& db)
+    {
+      CloudFrame f;
+      f.depth = db;
+      f.depth_meters = *depth_meters;
+      f.depth_format = depth_format;
+      f.rgb = cb;
+      f.pose = poseFromRT(*R, *T);
+      setFrameGeometry(f, *depth_width, *depth_height, *image_width, *image_height, *image_channels, *depth_K,
+                       *image_K);
+      f.depth_to_image = poseFromRT(*image_R, *image_T);
+      if (*kinect_calibration)
+        setKinectCalibration(f, *depth_K, *image_K, *image_R, *image_T);
+      return f;
+    }
+
+    /** Copy the newest read back frame to the image output, if there is one we have not output yet. */
+    void
+    outputFrame()
+    {
+      ReadbackImageConstPtr frame = window->lastFrame();
+      if (!frame || frame == last_frame)
+        return;
+      last_frame = frame;
+      cv::Mat(frame->height, frame->width, CV_8UC3, const_cast<unsigned char*>(frame->bgr.data())).copyTo(*image);
+    }
+
     ecto::spore<int> depth_width, depth_height, image_width, image_height, image_channels;
     ecto::spore<DepthDataConstPtr> depth_buffer;
+    ecto::spore<DepthMetersDataConstPtr> depth_meters;
     ecto::spore<RgbDataConstPtr> image_buffer;
-    ecto::spore<std::string> window_name;
+    ecto::spore<cv::Mat> depth_K, image_K, image_R, image_T, R, T;
+    ecto::spore<int> history_length;
+    ecto::spore<std::string> window_name, share_group, layout;
+    ecto::spore<bool> async_upload, inline_render, readback, low_latency, lambert, output_normals,
+        output_filtered_depth, mesh, kinect_calibration, find_plane;
+    ecto::spore<int> swap_interval, max_frames_in_flight, bilateral_kernel, mesh_step;
+    ecto::spore<float> bilateral_sigma_space, bilateral_sigma_range, temporal_alpha, temporal_motion, max_jump,
+        mesh_max_edge, color_range_min, color_range_max, plane_threshold;
+    ecto::spore<cv::Mat> image, normals, filtered_depth, plane, plane_mask;
+
+    DepthFormat depth_format;
+    DepthMetersIdentity meters_identity;
+    int color;
+    Vector3f up;
 
     boost::shared_ptr<CloudWindow> window;
+    ReadbackImageConstPtr last_frame;
   };
 }
 ECTO_CELL(ecto_gl, ecto_gl::PointCloudDisplay, "PointCloudDisplay", "A glut point cloud viewer")
@@ -0,0 +1,469 @@
+#include <ecto/ecto.hpp>
+#include <GL/glew.h>
+
+#include "ecto_gl.hpp"
+#include "cloud.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace ecto_gl
+{
+  using Eigen::Vector3f;
+  using Eigen::Matrix4f;
+
+  using ecto::tendrils;
+  using ecto::spore;
+
+  struct PointsProgram
+  {
+    enum ColorMode
+    {
+      RGB = 0, INTENSITY = 1, PLAIN = 2
+    };
+
+    PointsProgram()
+    {
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          attribute vec3 position;
+          attribute vec3 rgb;
+          attribute float intensity;
+          varying vec4 color;
+          uniform mat4 projection_modelview;
+          uniform int color_mode;
+          uniform vec2 intensity_range;
+          void main()
+          {
+            if (color_mode == 0)
+              color = vec4(rgb, 1.);
+            else if (color_mode == 1)
+              color = vec4(vec3(clamp((intensity - intensity_range[0]) / intensity_range[1], 0., 1.)), 1.);
+            else
+              color = vec4(1.);
+            gl_Position = projection_modelview * vec4(position, 1.);
+            gl_PointSize = 2.0;
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          varying vec4 color;
+          void main()
+          {
+            gl_FragColor = color;
+          }
+      );
+      program.reset(new GlProgram(vertexShader, fragmentShader));
+      projection_modelview = glGetUniformLocation(program->program, "projection_modelview");
+      color_mode = glGetUniformLocation(program->program, "color_mode");
+      intensity_range = glGetUniformLocation(program->program, "intensity_range");
+      positionHandle = glGetAttribLocation(program->program, "position");
+      rgbHandle = glGetAttribLocation(program->program, "rgb");
+      intensityHandle = glGetAttribLocation(program->program, "intensity");
+
+      CHECK_GLUT_ERROR
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint projection_modelview, color_mode, intensity_range;
+    GLint positionHandle, rgbHandle, intensityHandle;
+  };
+
+  /**
+   * A vertex buffer whose storage only grows, by at least half its capacity at
+   * a time, so streams of varying length rarely reallocate. Each upload
+   * invalidates the old contents, letting the driver hand out fresh memory
+   * instead of waiting for draws still reading the previous frame.
+   */
+  struct GrowableBuffer: boost::noncopyable
+  {
+    GrowableBuffer()
+        :
+          buffer(0),
+          capacity(0),
+          size(0),
+          reallocations(0)
+    {
+      glGenBuffers(1, &buffer);
+    }
+
+    ~GrowableBuffer()
+    {
+      glDeleteBuffers(1, &buffer);
+    }
+
+    void
+    upload(const void* data, size_t bytes)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, buffer);
+      if (bytes > capacity)
+      {
+        capacity = std::max(bytes, capacity + capacity / 2);
+        glBufferData(GL_ARRAY_BUFFER, capacity, 0, GL_STREAM_DRAW);
+        ++reallocations;
+      }
+      size = bytes;
+      if (bytes)
+      {
+        void* dst = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (dst)
+        {
+          std::memcpy(dst, data, bytes);
+          glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      CHECK_GLUT_ERROR
+    }
+
+    GLuint buffer;
+    size_t capacity, size;
+    size_t reallocations;
+  };
+
+  /** One frame of unorganized points, with per point RGB or intensity if given. */
+  struct PointsFrame
+  {
+    PointsDataConstPtr points;
+    RgbDataConstPtr rgb;
+    IntensityDataConstPtr intensity;
+  };
+
+  struct PointsBuffers: boost::noncopyable
+  {
+    PointsBuffers()
+        :
+          n(0),
+          order(0),
+          order_n(0),
+          color_mode(PointsProgram::PLAIN),
+          intensity_min(0),
+          intensity_max(1),
+          bytes_uploaded(0),
+          frames_uploaded(0)
+    {
+    }
+
+    ~PointsBuffers()
+    {
+      glDeleteBuffers(1, &order);
+    }
+
+    /** Upload a frame unless it is already on the GPU; true if it was uploaded. */
+    bool
+    setData(const PointsFrame& f)
+    {
+      if (!f.points || f.points == frame.points)
+        return false;
+      n = f.points->size() / 3;
+      positions.upload(f.points->data(), sizeof(float) * 3 * n);
+      bytes_uploaded += positions.size;
+      color_mode = PointsProgram::PLAIN;
+      if (f.rgb && f.rgb->size() >= 3 * n)
+      {
+        colors.upload(f.rgb->data(), 3 * n);
+        bytes_uploaded += colors.size;
+        color_mode = PointsProgram::RGB;
+      }
+      else if (f.intensity && f.intensity->size() >= n && n)
+      {
+        intensities.upload(f.intensity->data(), sizeof(float) * n);
+        bytes_uploaded += intensities.size;
+        color_mode = PointsProgram::INTENSITY;
+        intensity_min = *std::min_element(f.intensity->begin(), f.intensity->begin() + n);
+        intensity_max = *std::max_element(f.intensity->begin(), f.intensity->begin() + n);
+      }
+      frame = f;
+      ++frames_uploaded;
+      return true;
+    }
+
+    /**
+     * Index the points in a fixed random order, so that drawing any range of
+     * the indices draws a random sample. Only redone when the count changes.
+     */
+    void
+    shuffle()
+    {
+      if (order_n == n)
+        return;
+      std::vector<uint32_t> indices(n);
+      for (size_t i = 0; i < n; i++)
+        indices[i] = i;
+      stableShuffle(indices.begin(), indices.end());
+      if (!order)
+        glGenBuffers(1, &order);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, order);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, n * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      order_n = n;
+    }
+
+    /** Draw all points, or the range [begin, end) of the shuffled order as fractions of n, shuffling if it is stale. */
+    void
+    draw(const PointsProgram& program, const Camera& c, double begin = 0, double end = 1)
+    {
+      if (!n)
+        return;
+      glViewport(c.vpX(), c.vpY(), c.vpWidth(), c.vpHeight());
+      glUseProgram(program.program->program);
+      glEnableVertexAttribArray(program.positionHandle);
+      glBindBuffer(GL_ARRAY_BUFFER, positions.buffer);
+      glVertexAttribPointer(program.positionHandle, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*) 0);
+      if (color_mode == PointsProgram::RGB && program.rgbHandle >= 0)
+      {
+        glEnableVertexAttribArray(program.rgbHandle);
+        glBindBuffer(GL_ARRAY_BUFFER, colors.buffer);
+        glVertexAttribPointer(program.rgbHandle, 3, GL_UNSIGNED_BYTE, GL_TRUE, 3, (void*) 0);
+      }
+      if (color_mode == PointsProgram::INTENSITY && program.intensityHandle >= 0)
+      {
+        glEnableVertexAttribArray(program.intensityHandle);
+        glBindBuffer(GL_ARRAY_BUFFER, intensities.buffer);
+        glVertexAttribPointer(program.intensityHandle, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*) 0);
+      }
+      CHECK_GLUT_ERROR
+
+      glUniform1i(program.color_mode, color_mode);
+      glUniform2f(program.intensity_range, intensity_min, std::max(intensity_max - intensity_min, 1e-6f));
+      Matrix4f p = c.projectionMatrix() * c.viewMatrix().matrix();
+      glUniformMatrix4fv(program.projection_modelview, 1, false, p.data());
+
+      glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+      if (begin == 0 && end == 1)
+        glDrawArrays(GL_POINTS, 0, n);
+      else
+      {
+        //the budget can change inside ProgressiveDraw::draw, so refresh a stale order here rather than in display().
+        shuffle();
+        size_t first = begin * n, last = end * n;
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, order);
+        glDrawElements(GL_POINTS, last - first, GL_UNSIGNED_INT, (void*) (first * sizeof(uint32_t)));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      }
+      glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+      glDisableVertexAttribArray(program.positionHandle);
+      if (program.rgbHandle >= 0)
+        glDisableVertexAttribArray(program.rgbHandle);
+      if (program.intensityHandle >= 0)
+        glDisableVertexAttribArray(program.intensityHandle);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      glUseProgram(0);
+
+      CHECK_GLUT_ERROR
+    }
+
+    GrowableBuffer positions, colors, intensities;
+    size_t n;
+    GLuint order; //a shuffled index of the points, for drawing random samples
+    size_t order_n;
+    int color_mode;
+    float intensity_min, intensity_max;
+    PointsFrame frame; //the frame currently on the GPU
+    size_t bytes_uploaded, frames_uploaded;
+  };
+
+  class PointsWindow: public GLWindow
+  {
+  public:
+    PointsWindow(const std::string window_name)
+        :
+          GLWindow(window_name),
+          frames_drawn(0),
+          quit(false)
+    {
+    }
+
+    void
+    setData(const PointsFrame& f)
+    {
+      boost::mutex::scoped_lock lock(mtx);
+      frame = f;
+    }
+
+    virtual void
+    display()
+    {
+      glEnable(GL_DEPTH_TEST);
+      glClearColor(0.0f, 0.0f, 0.0f, 1.f);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      if (!program)
+        program.reset(new PointsProgram);
+      if (!points)
+        points.reset(new PointsBuffers);
+      bool changed;
+      {
+        boost::mutex::scoped_lock lock(mtx);
+        changed = points->setData(frame);
+      }
+      std::vector<Camera*> cameras = this->cameras();
+      if (cameras.size() == 1 && progressive.budget_)
+      {
+        //within the point budget while the view moves, filling in while it rests.
+        progressive.draw(camera_, points->n, changed,
+                         boost::bind(&PointsBuffers::draw, points.get(), boost::cref(*program), boost::cref(camera_),
+                                     _1, _2));
+        ++frames_drawn;
+        return;
+      }
+      for (size_t i = 0; i < cameras.size(); i++)
+      {
+        if (cameras.size() > 1)
+          beginView(*cameras[i]);
+        points->draw(*program, *cameras[i]);
+      }
+      ++frames_drawn;
+
+      CHECK_GLUT_ERROR
+    }
+
+    virtual void
+    init()
+    {
+      program.reset();
+      points.reset();
+      progressive.release();
+      camera_.setFovY(3.14f / 4);
+      camera_.setPosition(Vector3f(0, 0, -1));
+      camera_.setTarget(Vector3f(0, 0, 0));
+      Eigen::AngleAxisf aa(M_PI, Eigen::Vector3f(0, 0, 1));
+      Eigen::Quaternionf q(aa);
+      aa = Eigen::AngleAxisf(M_PI, Eigen::Vector3f(0, 1, 0));
+      q *= Eigen::Quaternionf(aa);
+      camera_.setOrientation(q);
+      view_center_ = Vector3f(0, 0, 2);
+      glewInit();
+
+      CHECK_GLUT_ERROR
+    }
+
+    void
+    keyboard(unsigned char key, int x, int y)
+    {
+      switch (key)
+      {
+        case 'q':
+          quit = true;
+          break;
+        case 's':
+          printStats(std::cout);
+          break;
+        default:
+          break;
+      }
+    }
+
+    void
+    printStats(std::ostream& out)
+    {
+      if (!points)
+        return;
+      out << windowname_ << ": drew " << frames_drawn << " frames, uploaded " << points->frames_uploaded
+          << " frames of up to " << points->positions.capacity / (3 * sizeof(float)) << " points";
+      if (points->frames_uploaded)
+        out << " at " << points->bytes_uploaded / points->frames_uploaded << " bytes/frame";
+      out << ", " << points->positions.reallocations + points->colors.reallocations
+             + points->intensities.reallocations
+          << " buffer reallocations" << std::endl;
+      if (progressive.budget_)
+        out << "  point budget " << progressive.budget_ << ", " << int(progressive.done_ * 100)
+            << "% drawn, gpu draw time [ms]: " << progressive.draw_ms_ << std::endl;
+    }
+
+    void
+    destroy()
+    {
+      program.reset();
+      points.reset();
+      progressive.release();
+    }
+
+    boost::shared_ptr<PointsProgram> program;
+    boost::shared_ptr<PointsBuffers> points;
+    ProgressiveDraw progressive;
+    PointsFrame frame;
+    boost::mutex mtx;
+    size_t frames_drawn;
+    bool quit;
+  };
+
+  struct PointsDisplay
+  {
+    static void
+    declare_params(tendrils& params)
+    {
+      params.declare<std::string>("window_name", "A name for the window.", "points.");
+      params.declare<std::string>("layout",
+                                  "Views of the points: single, split, pip or quad, as for PointCloudDisplay.",
+                                  "single");
+      params.declare<int>("point_budget",
+                          "Most points drawn per frame in the single layout, the rest filled in while the view "
+                          "rests; 0 draws all.",
+                          0);
+      params.declare<float>("target_fps", "Adapt the point budget to hold this frame rate; 0 keeps it fixed.", 0);
+    }
+
+    static void
+    declare_io(const tendrils& params, tendrils& i, tendrils& o)
+    {
+      i.declare<PointsDataConstPtr>("points", "Packed x, y, z floats in meters, any number of points.");
+      i.declare<RgbDataConstPtr>("colors", "Optional packed RGB bytes, one triple per point.");
+      i.declare<IntensityDataConstPtr>("intensity",
+                                       "Optional float per point, shown as gray over its range. Ignored with colors.");
+    }
+
+    void
+    configure(const tendrils& p, const tendrils& i, const tendrils& o)
+    {
+      points = i["points"];
+      colors = i["colors"];
+      intensity = i["intensity"];
+      window_name = p["window_name"];
+      layout = p["layout"];
+      point_budget = p["point_budget"];
+      target_fps = p["target_fps"];
+    }
+
+    int
+    process(const tendrils&, const tendrils&)
+    {
+      if (!window)
+      {
+        window.reset(new PointsWindow(*window_name));
+        window->setLayout(*layout);
+        window->progressive.budget_ = std::max(0, *point_budget);
+        window->progressive.target_fps_ = *target_fps;
+      }
+
+      if (window->quit)
+      {
+        ecto_gl::stop();
+        return ecto::QUIT;
+      }
+
+      ecto_gl::show_window(window);
+      if (*points)
+      {
+        PointsFrame f;
+        f.points = *points;
+        f.rgb = *colors;
+        f.intensity = *intensity;
+        window->setData(f);
+      }
+      return ecto::OK;
+    }
+
+    ecto::spore<PointsDataConstPtr> points;
+    ecto::spore<RgbDataConstPtr> colors;
+    ecto::spore<IntensityDataConstPtr> intensity;
+    ecto::spore<std::string> window_name, layout;
+    ecto::spore<int> point_budget;
+    ecto::spore<float> target_fps;
+
+    boost::shared_ptr<PointsWindow> window;
+  };
+}
+ECTO_CELL(ecto_gl, ecto_gl::PointsDisplay, "PointsDisplay", "A viewer for unorganized point arrays")
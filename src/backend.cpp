@@ -0,0 +1,90 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+#include "backend.hpp"
+
+namespace ecto_gl
+{
+  Backend::~Backend()
+  {
+  }
+
+  namespace
+  {
+    Backend&
+    select_backend()
+    {
+      const char* name = std::getenv("ECTO_GL_BACKEND");
+      const char* display = std::getenv("DISPLAY");
+      bool headless = name ? std::string(name) == "headless" : !display || !*display;
+#if ECTO_GL_HAVE_EGL
+      if (headless)
+        return headless_backend();
+#else
+      if (headless && name)
+        std::cerr << "ecto_gl was built without EGL, using the glut backend." << std::endl;
+#endif
+      return glut_backend();
+    }
+  }
+
+  Backend&
+  Backend::instance()
+  {
+    static boost::mutex mtx;
+    static Backend* backend = 0;
+    boost::mutex::scoped_lock lock(mtx);
+    if (!backend)
+      backend = &select_backend();
+    return *backend;
+  }
+
+  SharedContext::~SharedContext()
+  {
+  }
+
+  SharedContext::ptr
+  SharedContext::create()
+  {
+    return Backend::instance().create_shared_context();
+  }
+
+  void
+  show_window(GLWindow::ptr window)
+  {
+    Backend::instance().post_window(window);
+  }
+
+  void
+  render_inline(GLWindow::ptr window)
+  {
+    Backend::instance().render_inline(window);
+  }
+
+  void
+  destroy_window(GLWindow::ptr window)
+  {
+    Backend::instance().post_remove_window(window);
+  }
+
+  void
+  destroy_window(const GLWindow& window)
+  {
+    Backend::instance().post_remove_window(window);
+  }
+
+  void
+  wait()
+  {
+    Backend::instance().wait();
+  }
+
+  void
+  stop()
+  {
+    Backend::instance().stop();
+  }
+}
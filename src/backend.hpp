@@ -0,0 +1,55 @@
+#pragma once
+#include "ecto_gl.hpp"
+
+namespace ecto_gl
+{
+  /**
+   * A window system that owns the GL contexts of GLWindows and drives their
+   * display, input and timer callbacks. The free functions in ecto_gl.hpp
+   * forward to the backend picked by instance().
+   */
+  class Backend: boost::noncopyable
+  {
+  public:
+    virtual
+    ~Backend();
+
+    virtual void
+    post_window(GLWindow::ptr window) = 0;
+
+    virtual void
+    post_remove_window(GLWindow::ptr window) = 0;
+
+    virtual void
+    post_remove_window(const GLWindow& window) = 0;
+
+    virtual void
+    render_inline(GLWindow::ptr window) = 0;
+
+    virtual void
+    wait() = 0;
+
+    virtual void
+    stop() = 0;
+
+    /** Create a context sharing with the calling thread's current context. */
+    virtual SharedContext::ptr
+    create_shared_context() = 0;
+
+    /**
+     * The backend named by the ECTO_GL_BACKEND environment variable, "glut"
+     * or "headless". Without it, glut is used when DISPLAY is set and the
+     * headless backend otherwise.
+     */
+    static Backend&
+    instance();
+  };
+
+  Backend&
+  glut_backend();
+
+#if ECTO_GL_HAVE_EGL
+  Backend&
+  headless_backend();
+#endif
+}
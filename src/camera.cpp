@@ -121,6 +121,14 @@ namespace ecto_gl
     mProjIsUptodate = false;
   }
 
+  void
+  Camera::setClipPlanes(float nearDist, float farDist)
+  {
+    mNearDist = nearDist;
+    mFarDist = farDist;
+    mProjIsUptodate = false;
+  }
+
   Vector3f
   Camera::direction(void) const
   {
@@ -185,6 +193,19 @@ namespace ecto_gl
     mViewIsUptodate = false;
   }
 
+  void
+  Camera::frustumPlanes(Vector4f planes[6]) const
+  {
+    Matrix4f m = projectionMatrix() * viewMatrix().matrix();
+    for (int i = 0; i < 3; i++)
+    {
+      planes[2 * i] = (m.row(3) + m.row(i)).transpose();
+      planes[2 * i + 1] = (m.row(3) - m.row(i)).transpose();
+    }
+    for (int i = 0; i < 6; i++)
+      planes[i] /= planes[i].head<3>().norm();
+  }
+
   void
   Camera::rotateAroundTarget(const Quaternionf& q)
   {
@@ -98,6 +98,19 @@ namespace ecto_gl
     void
     setFovY(float value);
 
+    inline float
+    nearDist(void) const
+    {
+      return mNearDist;
+    }
+    inline float
+    farDist(void) const
+    {
+      return mFarDist;
+    }
+    void
+    setClipPlanes(float nearDist, float farDist);
+
     void
     setPosition(const Eigen::Vector3f& pos);
     inline const Eigen::Vector3f&
@@ -144,6 +157,13 @@ namespace ecto_gl
     const Eigen::Matrix4f&
     projectionMatrix(void) const;
 
+    /**
+     * The left, right, bottom, top, near and far clip planes in world
+     * coordinates, normalized, with p.dot(x, 1) >= 0 inside the frustum.
+     */
+    void
+    frustumPlanes(Eigen::Vector4f planes[6]) const;
+
     void
     rotateAroundTarget(const Eigen::Quaternionf& q);
     void
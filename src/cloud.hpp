@@ -0,0 +1,282 @@
+#pragma once
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+
+#include <Eigen/Geometry>
+#include <opencv2/core/core.hpp>
+
+namespace ecto_gl
+{
+  typedef std::vector<uint8_t> RgbData;
+  typedef std::vector<uint16_t> DepthData;
+
+  typedef boost::shared_ptr<RgbData> RgbDataPtr;
+  typedef boost::shared_ptr<DepthData> DepthDataPtr;
+
+  typedef boost::shared_ptr<const RgbData> RgbDataConstPtr;
+  typedef boost::shared_ptr<const DepthData> DepthDataConstPtr;
+
+  /** Unorganized points as packed x, y, z floats, and one float intensity per point. */
+  typedef std::vector<float> PointsData;
+  typedef std::vector<float> IntensityData;
+
+  typedef boost::shared_ptr<PointsData> PointsDataPtr;
+  typedef boost::shared_ptr<const PointsData> PointsDataConstPtr;
+  typedef boost::shared_ptr<const IntensityData> IntensityDataConstPtr;
+
+  /** Depth as float meters, from sensors such as time of flight cameras. */
+  typedef std::vector<float> DepthMetersData;
+  typedef boost::shared_ptr<const DepthMetersData> DepthMetersDataConstPtr;
+
+  /** How the samples of a depth frame encode distance. */
+  enum DepthFormat
+  {
+    DEPTH_MILLIMETERS, //uint16_t millimeters in depth, 0 where there is none
+    DEPTH_METERS, //float meters in depth_meters, 0 or NaN where there is none
+    DEPTH_DISPARITY //raw 11 bit Kinect disparity in depth, 2047 where there is none
+  };
+
+  static const int DISPARITY_LEVELS = 2048;
+
+  /** Meters of a raw Kinect disparity, 0 where there is none, from a typical calibration. */
+  inline float
+  kinectDisparityMeters(int disparity)
+  {
+    float inverse = 3.3309495f - 0.0030711016f * disparity;
+    return disparity < DISPARITY_LEVELS - 1 && inverse > 0 ? 1.f / inverse : 0.f;
+  }
+
+  /**
+   * Shuffle with a fixed seed, so the same input always comes out in the same
+   * order and any range of the result is a random sample of the whole.
+   */
+  template<typename It>
+  void
+  stableShuffle(It begin, It end, uint32_t seed = 1)
+  {
+    uint32_t x = seed ? seed : 1;
+    for (ptrdiff_t i = end - begin - 1; i > 0; i--)
+    {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      std::iter_swap(begin + i, begin + x % (i + 1));
+    }
+  }
+
+  /** Element (r, c) of a single channel float or double matrix. */
+  inline double
+  matAt(const cv::Mat& m, int r, int c)
+  {
+    return m.depth() == CV_64F ? m.at<double>(r, c) : m.at<float>(r, c);
+  }
+
+  /**
+   * Pinhole intrinsics as (fx, fy, cx, cy) from a 3x3 camera matrix. Without
+   * one, assume a Kinect-like 525 pixel focal length at 640 columns, scaled to
+   * the given resolution.
+   */
+  inline Eigen::Vector4f
+  intrinsicsFromK(const cv::Mat& K, int width = 640, int height = 480)
+  {
+    if (K.empty())
+    {
+      float f = 525.f * width / 640.f;
+      return Eigen::Vector4f(f, f, width / 2.f - .5f, height / 2.f - .5f);
+    }
+    return Eigen::Vector4f(matAt(K, 0, 0), matAt(K, 1, 1), matAt(K, 0, 2), matAt(K, 1, 2));
+  }
+
+  /**
+   * A depth frame with its color image, which may have another resolution,
+   * the intrinsics of both cameras, the transform from the depth camera frame
+   * to the color camera frame and the depth camera's pose in the world.
+   * Defaults to Kinect VGA for both, registered, at the origin.
+   *
+   * depth identifies the frame: code that caches what it computed from a
+   * frame compares depth pointers. For DEPTH_METERS frames it holds no samples.
+   */
+  struct CloudFrame
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    CloudFrame()
+        :
+          depth_width(640),
+          depth_height(480),
+          image_width(640),
+          image_height(480),
+          image_channels(3),
+          depth_format(DEPTH_MILLIMETERS),
+          depth_K(intrinsicsFromK(cv::Mat())),
+          image_K(depth_K),
+          depth_to_image(Eigen::Affine3f::Identity()),
+          pose(Eigen::Affine3f::Identity())
+    {
+    }
+    DepthDataConstPtr depth;
+    DepthMetersDataConstPtr depth_meters;
+    RgbDataConstPtr rgb;
+    int depth_width, depth_height;
+    int image_width, image_height, image_channels;
+    DepthFormat depth_format;
+    Eigen::Vector4f depth_K, image_K;
+    Eigen::Affine3f depth_to_image; //identity for depth registered to the color image
+    Eigen::Affine3f pose;
+  };
+
+  /** Samples in the frame's depth format, for checking a frame's size. */
+  inline size_t
+  depthSamples(const CloudFrame& f)
+  {
+    if (f.depth_format == DEPTH_METERS)
+      return f.depth_meters ? f.depth_meters->size() : 0;
+    return f.depth ? f.depth->size() : 0;
+  }
+
+  inline size_t
+  depthBytes(const CloudFrame& f)
+  {
+    return depthSamples(f) * (f.depth_format == DEPTH_METERS ? sizeof(float) : sizeof(uint16_t));
+  }
+
+  /** Bytes of depth and color a frame uploads. */
+  inline size_t
+  uploadBytes(const CloudFrame& f)
+  {
+    return depthBytes(f) + (f.rgb ? sizeof(uint8_t) * f.rgb->size() : 0);
+  }
+
+  /**
+   * Millimeters of a distance in meters, as depth is held on the GPU: 0 where
+   * there is none or it is out of range.
+   */
+  inline uint16_t
+  metersToMillimeters(float m)
+  {
+    return m > 0 && m < 65.535f ? uint16_t(m * 1000.f + .5f) : 0;
+  }
+
+  /** Sample i of a frame in millimeters, 0 where there is none. */
+  inline uint16_t
+  depthMillimeters(const CloudFrame& f, size_t i)
+  {
+    switch (f.depth_format)
+    {
+      case DEPTH_METERS:
+        return metersToMillimeters((*f.depth_meters)[i]);
+      case DEPTH_DISPARITY:
+        return metersToMillimeters(kinectDisparityMeters((*f.depth)[i]));
+      default:
+        return (*f.depth)[i];
+    }
+  }
+
+  /** The format named "millimeters", "meters" or "disparity", for cell parameters. */
+  inline DepthFormat
+  parseDepthFormat(const std::string& name)
+  {
+    if (name == "millimeters")
+      return DEPTH_MILLIMETERS;
+    if (name == "meters")
+      return DEPTH_METERS;
+    if (name == "disparity")
+      return DEPTH_DISPARITY;
+    throw std::runtime_error("Unknown depth_format " + name + ", expected millimeters, meters or disparity.");
+  }
+
+  /**
+   * The depth that identifies DEPTH_METERS frames for cells: an empty one,
+   * the same for as long as the meters are.
+   */
+  struct DepthMetersIdentity
+  {
+    DepthDataConstPtr
+    operator()(const DepthMetersDataConstPtr& meters)
+    {
+      if (meters != meters_)
+      {
+        meters_ = meters;
+        depth_.reset(meters ? new DepthData : 0);
+      }
+      return depth_;
+    }
+    DepthMetersDataConstPtr meters_;
+    DepthDataConstPtr depth_;
+  };
+
+  /** The rigid transform x -> R x + T, taking empty matrices as identity and zero. */
+  inline Eigen::Affine3f
+  poseFromRT(const cv::Mat& R, const cv::Mat& T)
+  {
+    Eigen::Affine3f pose = Eigen::Affine3f::Identity();
+    if (!R.empty())
+      for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+          pose.linear()(r, c) = matAt(R, r, c);
+    if (!T.empty())
+      for (int r = 0; r < 3; r++)
+        pose.translation()[r] = matAt(T.reshape(1, 3), r, 0);
+    return pose;
+  }
+
+  /**
+   * Fill in a frame's sizes and intrinsics from the usual cell inputs. Unset
+   * sizes keep the VGA RGB defaults, an empty depth_K gives Kinect defaults and
+   * an empty image_K the depth intrinsics scaled to the image resolution.
+   */
+  inline void
+  setFrameGeometry(CloudFrame& f, int depth_width, int depth_height, int image_width, int image_height,
+                   int image_channels, const cv::Mat& depth_K, const cv::Mat& image_K)
+  {
+    if (depth_width > 0 && depth_height > 0)
+    {
+      f.depth_width = depth_width;
+      f.depth_height = depth_height;
+    }
+    if (image_width > 0 && image_height > 0)
+    {
+      f.image_width = image_width;
+      f.image_height = image_height;
+    }
+    if (image_channels > 0)
+      f.image_channels = image_channels;
+    f.depth_K = intrinsicsFromK(depth_K, f.depth_width, f.depth_height);
+    if (!image_K.empty())
+      f.image_K = intrinsicsFromK(image_K);
+    else
+    {
+      //same field of view, registered to the depth camera.
+      float sx = float(f.image_width) / f.depth_width, sy = float(f.image_height) / f.depth_height;
+      f.image_K = Eigen::Vector4f(f.depth_K[0] * sx, f.depth_K[1] * sy, (f.depth_K[2] + .5f) * sx - .5f,
+                                  (f.depth_K[3] + .5f) * sy - .5f);
+    }
+  }
+
+  /**
+   * Typical factory calibration of a Kinect running unregistered, scaled to
+   * the frame's resolutions: the intrinsics of its depth and color cameras,
+   * and the color camera about 2 cm to the side of the depth camera. Only
+   * fills in what the cell inputs left empty.
+   */
+  inline void
+  setKinectCalibration(CloudFrame& f, const cv::Mat& depth_K, const cv::Mat& image_K, const cv::Mat& R,
+                       const cv::Mat& T)
+  {
+    if (depth_K.empty())
+      f.depth_K = Eigen::Vector4f(594.21f, 591.04f, 339.31f, 242.74f) * (f.depth_width / 640.f);
+    if (image_K.empty())
+      f.image_K = Eigen::Vector4f(529.22f, 525.56f, 328.94f, 267.48f) * (f.image_width / 640.f);
+    if (R.empty() && T.empty())
+    {
+      f.depth_to_image.linear() << 0.99985f, -0.00147f, 0.01739f, 0.00126f, 0.99996f, 0.00860f, -0.01740f, -0.00858f,
+          0.99982f;
+      f.depth_to_image.translation() = Eigen::Vector3f(0.019985f, -0.000744f, -0.010917f);
+    }
+  }
+}
@@ -0,0 +1,2029 @@
+#pragma once
+#include <GL/glew.h>
+
+#include "ecto_gl.hpp"
+#include "cloud.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <opencv2/core/core.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * The GL side of depth frames: the program that unprojects depth pixels on
+ * the GPU and the buffers a frame is uploaded to. Shared by the cells that
+ * draw or compute with depth frames.
+ */
+namespace ecto_gl
+{
+  /** The turbo colormap at x in [0, 1], from dark blue through green to dark red, by its polynomial fit. */
+  inline Eigen::Vector3f
+  turboColor(float x)
+  {
+    x = std::min(std::max(x, 0.f), 1.f);
+    Eigen::Vector4f v4(1, x, x * x, x * x * x);
+    Eigen::Vector2f v2(v4[2] * v4[2], v4[2] * v4[3]);
+    Eigen::Vector3f c(v4.dot(Eigen::Vector4f(0.13572138f, 4.61539260f, -42.66032258f, 132.13108234f))
+                      + v2.dot(Eigen::Vector2f(-152.94239396f, 59.28637943f)),
+                      v4.dot(Eigen::Vector4f(0.09140261f, 2.19418839f, 4.84296658f, -14.18503333f))
+                      + v2.dot(Eigen::Vector2f(4.27729857f, 2.82956604f)),
+                      v4.dot(Eigen::Vector4f(0.10667330f, 12.64194608f, -60.58204836f, 110.36276771f))
+                      + v2.dot(Eigen::Vector2f(-89.90310912f, 27.34824973f)));
+    return c.cwiseMax(0.f).cwiseMin(1.f);
+  }
+
+  struct CloudProgram: boost::noncopyable
+  {
+    /** What colors the points: the color image, or a colormap of their depth or height, or their normal. */
+    enum ColorMode
+    {
+      RGB = 0, DEPTH = 1, HEIGHT = 2, NORMAL = 3
+    };
+
+    static const int COLORMAP_SIZE = 256;
+
+    /**
+     * With feedback set, the program is linked to capture xyz, each point in
+     * the depth camera frame, and packed_rgb, its color in the low three
+     * bytes, by transform feedback.
+     *
+     * With max_jump above 0, points whose depth differs from one of their 8
+     * neighbors' in the edges texture by more than max_jump times their own
+     * are flying pixels, mixed from the surfaces on both sides of an edge:
+     * they are clipped, and captured with xyz at the origin like holes.
+     *
+     * With mesh set, the program draws triangles between depth pixels, see
+     * CloudData::draw(). A geometry shader drops those with a vertex without
+     * depth, or an edge longer than max_edge times the depth at its nearer end.
+     *
+     * DEPTH and HEIGHT look up the colormap texture at
+     * dot(color_plane.xyz, p) + color_plane.w of each point p, which covers
+     * both with the plane given in the depth camera frame, scaled from
+     * color_range, its start and extent. NORMAL colors by the normal map
+     * turned to the world by normal_to_world, gray where there is none.
+     *
+     * With plane_threshold above 0, points within it of the plane in texel 0
+     * of the plane texture, see PlaneFit, are highlighted in green.
+     */
+    CloudProgram(bool feedback = false, bool mesh = false)
+        :
+          colormap_texture(0),
+          mesh(mesh)
+    {
+      //gl_VertexID and integer % need GLSL 1.30, which strict drivers such as llvmpipe enforce.
+      //color is looked up by projecting each point into the color camera, so it
+      //may have any resolution, and need not be registered to the depth.
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          attribute float depth;
+          varying vec4 color;
+          out vec3 xyz;
+          flat out uint packed_rgb;
+          uniform mat4 projection_modelview;
+          uniform vec4 depth_K;
+          uniform vec4 image_K;
+          uniform mat4 depth_to_image;
+          uniform vec2 image_size;
+          uniform int depth_width;
+          uniform sampler2D rgb;
+          uniform bool gray;
+          uniform float fade;
+          uniform bool shade;
+          uniform sampler2D normals;
+          uniform vec3 light;
+          uniform usampler2D edges;
+          uniform float max_jump;
+          uniform int color_mode;
+          uniform sampler2D colormap;
+          uniform vec4 color_plane;
+          uniform vec2 color_range;
+          uniform mat3 normal_to_world;
+          uniform sampler2D plane;
+          uniform float plane_threshold;
+          void main()
+          {
+            float y = float(gl_VertexID/depth_width);
+            float x = float(gl_VertexID%depth_width);
+
+            vec4 position;
+            float d = depth / 1000.;
+            position[0] = (x - depth_K[2])*d/depth_K[0];
+            position[1] = (y - depth_K[3])*d/depth_K[1];
+            position[2] = d;
+            position[3] = 1;
+
+            bool flying = false;
+            if (max_jump > 0. && depth > 0.)
+            {
+              ivec2 p = ivec2(int(x), int(y));
+              ivec2 last = textureSize(edges, 0) - 1;
+              for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                  float e = float(texelFetch(edges, clamp(p + ivec2(dx, dy), ivec2(0), last), 0).r);
+                  flying = flying || (e > 0. && abs(e - depth) > max_jump * depth);
+                }
+            }
+
+            vec3 c;
+            if (color_mode == 1 || color_mode == 2)
+            {
+              float t = clamp((dot(color_plane.xyz, position.xyz) + color_plane.w - color_range[0]) / color_range[1],
+                              0., 1.);
+              c = texture(colormap, vec2((t * 255. + .5) / 256., .5)).rgb;
+            }
+            else if (color_mode == 3)
+            {
+              vec4 n = texelFetch(normals, ivec2(int(x), int(y)), 0);
+              c = n.w > 0. ? normal_to_world * n.xyz * .5 + .5 : vec3(.5);
+            }
+            else
+            {
+              vec4 q = depth_to_image * position;
+              vec2 uv = (image_K.xy * q.xy / max(q.z, 1e-3) + image_K.zw + .5) / image_size;
+              vec4 texel = texture(rgb, uv);
+              c = gray ? texel.rrr : texel.rgb;
+            }
+            if (shade)
+            {
+              vec4 n = texelFetch(normals, ivec2(int(x), int(y)), 0);
+              if (n.w > 0.)
+                c *= .2 + .8 * max(dot(n.xyz, normalize(light - position.xyz)), 0.);
+            }
+            if (plane_threshold > 0.)
+            {
+              vec4 pl = texelFetch(plane, ivec2(0), 0);
+              if (dot(pl.xyz, pl.xyz) > 0. && abs(dot(pl.xyz, position.xyz) + pl.w) < plane_threshold)
+                c = mix(c, vec3(0., 1., 0.), .5);
+            }
+            color = vec4(c * fade, 1.);
+            xyz = flying ? vec3(0.) : position.xyz;
+            uvec3 b = uvec3(c * 255. + .5);
+            packed_rgb = b.r | (b.g << 8u) | (b.b << 16u);
+            gl_Position = flying ? vec4(0., 0., 2., 1.) : projection_modelview*position;
+            gl_PointSize = 2.0;
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          precision mediump float;
+          varying vec4 color;
+          void main()
+          {
+            gl_FragColor = color;
+          };
+      );
+
+      static const char meshGeometryShader[] = "#version 150\n" SHADER_STR(
+          layout(triangles) in;
+          layout(triangle_strip, max_vertices = 3) out;
+          in vec4 color[];
+          in vec3 xyz[];
+          out vec4 mesh_color;
+          uniform float max_edge;
+          void main()
+          {
+            for (int i = 0; i < 3; i++)
+            {
+              vec3 a = xyz[i];
+              vec3 b = xyz[(i + 1) % 3];
+              if (a.z <= 0. || distance(a, b) > max_edge * min(a.z, b.z))
+                return;
+            }
+            for (int i = 0; i < 3; i++)
+            {
+              mesh_color = color[i];
+              gl_Position = gl_in[i].gl_Position;
+              EmitVertex();
+            }
+            EndPrimitive();
+          }
+      );
+
+      static const char meshFragmentShader[] = "#version 130\n" SHADER_STR(
+          varying vec4 mesh_color;
+          void main()
+          {
+            gl_FragColor = mesh_color;
+          }
+      );
+      std::vector<std::string> varyings;
+      if (feedback)
+      {
+        varyings.push_back("xyz");
+        varyings.push_back("packed_rgb");
+      }
+      if (mesh)
+        program.reset(new GlProgram(vertexShader, meshFragmentShader, varyings, meshGeometryShader));
+      else
+        program.reset(new GlProgram(vertexShader, fragmentShader, varyings));
+      projection_modelview = glGetUniformLocation(program->program, "projection_modelview");
+      depth_K = glGetUniformLocation(program->program, "depth_K");
+      image_K = glGetUniformLocation(program->program, "image_K");
+      depth_to_image = glGetUniformLocation(program->program, "depth_to_image");
+      image_size = glGetUniformLocation(program->program, "image_size");
+      depth_width = glGetUniformLocation(program->program, "depth_width");
+      rgb = glGetUniformLocation(program->program, "rgb");
+      gray = glGetUniformLocation(program->program, "gray");
+      fade = glGetUniformLocation(program->program, "fade");
+      shade = glGetUniformLocation(program->program, "shade");
+      normals = glGetUniformLocation(program->program, "normals");
+      light = glGetUniformLocation(program->program, "light");
+      edges = glGetUniformLocation(program->program, "edges");
+      max_jump = glGetUniformLocation(program->program, "max_jump");
+      max_edge = glGetUniformLocation(program->program, "max_edge");
+      color_mode = glGetUniformLocation(program->program, "color_mode");
+      colormap = glGetUniformLocation(program->program, "colormap");
+      color_plane = glGetUniformLocation(program->program, "color_plane");
+      color_range = glGetUniformLocation(program->program, "color_range");
+      normal_to_world = glGetUniformLocation(program->program, "normal_to_world");
+      plane = glGetUniformLocation(program->program, "plane");
+      plane_threshold = glGetUniformLocation(program->program, "plane_threshold");
+      depthHandle = glGetAttribLocation(program->program, "depth");
+
+      //feedback only computes positions and the color image's colors.
+      if (!feedback)
+        makeColormap();
+
+      CHECK_GLUT_ERROR
+    }
+    ~CloudProgram()
+    {
+      glDeleteTextures(1, &colormap_texture);
+    }
+
+    /** Build colormap_texture from COLORMAP_SIZE samples of turboColor(). */
+    void
+    makeColormap()
+    {
+      std::vector<uint8_t> colors(3 * COLORMAP_SIZE);
+      for (int i = 0; i < COLORMAP_SIZE; i++)
+      {
+        Eigen::Vector3f c = turboColor(i / float(COLORMAP_SIZE - 1));
+        for (int k = 0; k < 3; k++)
+          colors[3 * i + k] = uint8_t(c[k] * 255.f + .5f);
+      }
+      glGenTextures(1, &colormap_texture);
+      glBindTexture(GL_TEXTURE_2D, colormap_texture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, COLORMAP_SIZE, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, colors.data());
+      glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    boost::shared_ptr<GlProgram> program;
+    GLint projection_modelview, depth_K, image_K, image_size, depth_width, rgb, gray, fade, shade, normals, light;
+    GLint edges, max_jump, max_edge, depth_to_image;
+    GLint color_mode, colormap, color_plane, color_range, normal_to_world, plane, plane_threshold;
+    GLuint depthHandle;
+    GLuint colormap_texture;
+    bool mesh;
+  };
+
+  /** The mesh variant of CloudProgram, for share group resources. */
+  struct CloudMeshProgram: CloudProgram
+  {
+    CloudMeshProgram()
+        :
+          CloudProgram(false, true)
+    {
+    }
+  };
+
+  /**
+   * Renders the normal map of a depth frame, one normal per depth pixel in
+   * the depth camera frame, facing the camera, with w = 1. Each comes from
+   * the cross product of central differences of the unprojected neighbors,
+   * falling back to one sided differences at holes and edges. Neighbors
+   * farther than max_jump times the pixel's depth are taken for another
+   * surface and ignored. Pixels without a normal get all zeros.
+   */
+  struct NormalProgram
+  {
+    NormalProgram()
+    {
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          void main()
+          {
+            vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+            gl_Position = vec4(corner * 2. - 1., 0., 1.);
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          uniform usampler2D depth;
+          uniform vec4 depth_K;
+          uniform float max_jump;
+          out vec4 normal;
+          vec3 point(ivec2 p)
+          {
+            float d = float(texelFetch(depth, p, 0).r) / 1000.;
+            return vec3((vec2(p) - depth_K.zw) * d / depth_K.xy, d);
+          }
+          bool usable(ivec2 q, vec3 c, out vec3 v)
+          {
+            if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, textureSize(depth, 0))))
+              return false;
+            v = point(q);
+            return v.z > 0. && abs(v.z - c.z) < max_jump * c.z;
+          }
+          vec3 tangent(ivec2 p, ivec2 step, vec3 c)
+          {
+            vec3 a = c;
+            vec3 b = c;
+            vec3 v;
+            if (usable(p + step, c, v))
+              b = v;
+            if (usable(p - step, c, v))
+              a = v;
+            return b - a;
+          }
+          void main()
+          {
+            ivec2 p = ivec2(gl_FragCoord.xy);
+            vec3 c = point(p);
+            vec3 n = c.z > 0. ? cross(tangent(p, ivec2(1, 0), c), tangent(p, ivec2(0, 1), c)) : vec3(0.);
+            if (dot(n, n) == 0.)
+            {
+              normal = vec4(0.);
+              return;
+            }
+            n = normalize(n);
+            normal = vec4(dot(n, c) > 0. ? -n : n, 1.);
+          }
+      );
+      program.reset(new GlProgram(vertexShader, fragmentShader));
+      depth = glGetUniformLocation(program->program, "depth");
+      depth_K = glGetUniformLocation(program->program, "depth_K");
+      max_jump = glGetUniformLocation(program->program, "max_jump");
+
+      CHECK_GLUT_ERROR
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint depth, depth_K, max_jump;
+  };
+
+//  std::vector<float>
+//  fill_uv(int w = 640, int h = 480)
+//  {
+//    std::vector<float> uv(w * h * 2);
+//    float* uvp = uv.data();
+//    for (int v = 0; v < h; v++)
+//      for (int u = 0; u < w; u++)
+//      {
+//        *(uvp++) = u;
+//        *(uvp++) = v;
+//      }
+//    return uv;
+//  }
+
+  /**
+   * Bilaterally filters a depth texture: each pixel becomes the mean of the
+   * valid depths within radius, weighted by exp(-space_k * pixels^2 -
+   * range_k * millimeters^2) of their distance from it. Holes stay holes.
+   * Renders to an R16UI target.
+   */
+  struct BilateralProgram
+  {
+    BilateralProgram()
+    {
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          void main()
+          {
+            vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+            gl_Position = vec4(corner * 2. - 1., 0., 1.);
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          uniform usampler2D depth;
+          uniform int radius;
+          uniform float space_k;
+          uniform float range_k;
+          out uvec4 filtered;
+          void main()
+          {
+            ivec2 p = ivec2(gl_FragCoord.xy);
+            float c = float(texelFetch(depth, p, 0).r);
+            if (c == 0.)
+            {
+              filtered = uvec4(0u);
+              return;
+            }
+            ivec2 last = textureSize(depth, 0) - 1;
+            float sum = 0.;
+            float weights = 0.;
+            for (int dy = -radius; dy <= radius; dy++)
+              for (int dx = -radius; dx <= radius; dx++)
+              {
+                float d = float(texelFetch(depth, clamp(p + ivec2(dx, dy), ivec2(0), last), 0).r);
+                float w = d > 0. ? exp(-float(dx * dx + dy * dy) * space_k - (d - c) * (d - c) * range_k) : 0.;
+                sum += w * d;
+                weights += w;
+              }
+            filtered = uvec4(uint(sum / weights + .5));
+          }
+      );
+      program.reset(new GlProgram(vertexShader, fragmentShader));
+      depth = glGetUniformLocation(program->program, "depth");
+      radius = glGetUniformLocation(program->program, "radius");
+      space_k = glGetUniformLocation(program->program, "space_k");
+      range_k = glGetUniformLocation(program->program, "range_k");
+
+      CHECK_GLUT_ERROR
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint depth, radius, space_k, range_k;
+  };
+
+  /**
+   * A texture drawn by a full screen pass, one fragment per texel. begin()
+   * makes it the render target and end() restores the framebuffer, viewport
+   * and depth test it found, so passes may run in the middle of drawing a
+   * window, which may itself render to a framebuffer object.
+   */
+  struct PixelPass: boost::noncopyable
+  {
+    PixelPass()
+        :
+          texture(0),
+          fbo(0),
+          width(0),
+          height(0)
+    {
+    }
+    ~PixelPass()
+    {
+      glDeleteFramebuffers(1, &fbo);
+      glDeleteTextures(1, &texture);
+    }
+
+    void
+    begin(int w, int h, GLenum internal_format, GLenum format, GLenum type)
+    {
+      glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &saved_fbo);
+      glGetIntegerv(GL_VIEWPORT, saved_viewport);
+      saved_depth_test = glIsEnabled(GL_DEPTH_TEST);
+      if (!fbo)
+      {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glGenFramebuffers(1, &fbo);
+      }
+      glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+      if (w != width || h != height)
+      {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, w, h, 0, format, type, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        width = w;
+        height = h;
+      }
+      glViewport(0, 0, w, h);
+      glDisable(GL_DEPTH_TEST);
+    }
+
+    void
+    end()
+    {
+      if (saved_depth_test)
+        glEnable(GL_DEPTH_TEST);
+      glBindFramebuffer(GL_FRAMEBUFFER, saved_fbo);
+      glViewport(saved_viewport[0], saved_viewport[1], saved_viewport[2], saved_viewport[3]);
+    }
+
+    GLuint texture, fbo;
+    int width, height;
+    GLint saved_fbo, saved_viewport[4];
+    GLboolean saved_depth_test;
+  };
+
+  /**
+   * Reads a pixel pass's texture into a cv::Mat through a pixel buffer. The
+   * copy out of the buffer happens on a later call, once its fence has
+   * passed, so the render thread never waits for the GPU.
+   */
+  struct PassReadback: boost::noncopyable
+  {
+    PassReadback()
+        :
+          pbo(0),
+          fence(0),
+          mat_type(0)
+    {
+    }
+
+    /** Start reading pass as format and type into a mat of mat_type; false while a read is in flight. */
+    bool
+    start(const PixelPass& pass, GLenum format, GLenum type, int mat_type)
+    {
+      if (fence || !pass.fbo)
+        return false;
+      size = cv::Size(pass.width, pass.height);
+      this->mat_type = mat_type;
+      if (!pbo)
+        glGenBuffers(1, &pbo);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+      glBufferData(GL_PIXEL_PACK_BUFFER, size.area() * CV_ELEM_SIZE(mat_type), 0, GL_STREAM_READ);
+      GLint read_fbo = 0;
+      glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fbo);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, pass.fbo);
+      glReadBuffer(GL_COLOR_ATTACHMENT0);
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+      glReadPixels(0, 0, size.width, size.height, format, type, 0);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+      CHECK_GLUT_ERROR
+      return true;
+    }
+
+    /** The pixels of the last read into a new mat, if it has finished. */
+    bool
+    finish(cv::Mat& mat)
+    {
+      if (!fence)
+        return false;
+      GLenum status = glClientWaitSync(fence, 0, 0);
+      if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+      glDeleteSync(fence);
+      fence = 0;
+      cv::Mat out(size, mat_type);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+      const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, out.total() * out.elemSize(), GL_MAP_READ_BIT);
+      if (data)
+      {
+        std::memcpy(out.data, data, out.total() * out.elemSize());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        mat = out;
+      }
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      return data;
+    }
+
+    /** Delete the GL objects, with the context current. */
+    void
+    release()
+    {
+      if (fence)
+        glDeleteSync(fence);
+      glDeleteBuffers(1, &pbo);
+      fence = 0;
+      pbo = 0;
+    }
+
+    GLuint pbo;
+    GLsync fence;
+    cv::Size size;
+    int mat_type;
+  };
+
+  /**
+   * Converts depth in another format to millimeters, rendering to an R16UI
+   * target: float meters as they are, raw disparity through a lookup table
+   * of the meters of every level. Millimeters are finer than the noise of
+   * time of flight and disparity depth, and span 65 m.
+   */
+  struct DepthConvertProgram: boost::noncopyable
+  {
+    DepthConvertProgram()
+    {
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          void main()
+          {
+            vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+            gl_Position = vec4(corner * 2. - 1., 0., 1.);
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          uniform usampler2D disparity;
+          uniform sampler2D meters;
+          uniform sampler2D lut;
+          uniform bool from_meters;
+          out uvec4 depth;
+          void main()
+          {
+            ivec2 p = ivec2(gl_FragCoord.xy);
+            float m;
+            if (from_meters)
+              m = texelFetch(meters, p, 0).r;
+            else
+              m = texelFetch(lut, ivec2(int(min(texelFetch(disparity, p, 0).r, 2047u)), 0), 0).r;
+            depth = uvec4(m > 0. && m < 65.535 ? uint(m * 1000. + .5) : 0u);
+          }
+      );
+      program.reset(new GlProgram(vertexShader, fragmentShader));
+      disparity = glGetUniformLocation(program->program, "disparity");
+      meters = glGetUniformLocation(program->program, "meters");
+      lut = glGetUniformLocation(program->program, "lut");
+      from_meters = glGetUniformLocation(program->program, "from_meters");
+
+      std::vector<float> levels(DISPARITY_LEVELS);
+      for (int i = 0; i < DISPARITY_LEVELS; i++)
+        levels[i] = kinectDisparityMeters(i);
+      glGenTextures(1, &lut_texture);
+      glBindTexture(GL_TEXTURE_2D, lut_texture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, DISPARITY_LEVELS, 1, 0, GL_RED, GL_FLOAT, levels.data());
+      glBindTexture(GL_TEXTURE_2D, 0);
+
+      CHECK_GLUT_ERROR
+    }
+    ~DepthConvertProgram()
+    {
+      glDeleteTextures(1, &lut_texture);
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint disparity, meters, lut, from_meters;
+    GLuint lut_texture;
+  };
+
+  /**
+   * The passes of a RANSAC fit of the dominant plane of a depth frame, as
+   * ax + by + cz + d = 0 in the depth camera frame in meters, with the camera
+   * on the positive side. Each pass is a stage of one program:
+   *  0. one hypothesis per texel: the plane through three random pixels near
+   *     each other, which likely lie on one surface, or zeros;
+   *  1. per hypothesis and row of the sample grid, every step-th pixel each
+   *     way, the number of samples within threshold of it;
+   *  2. the sums over rows, the inlier count of each hypothesis;
+   *  3. the best hypothesis refit to its inliers by their covariance, in a
+   *     single texel;
+   *  4. the inlier mask of the plane in hypotheses texel 0, at full resolution.
+   */
+  struct PlaneProgram
+  {
+    PlaneProgram()
+    {
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          void main()
+          {
+            vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+            gl_Position = vec4(corner * 2. - 1., 0., 1.);
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          uniform int stage;
+          uniform usampler2D depth;
+          uniform sampler2D hypotheses;
+          uniform sampler2D scores;
+          uniform sampler2D counts;
+          uniform vec4 depth_K;
+          uniform float threshold;
+          uniform int step;
+          uniform uint seed;
+          out vec4 result;
+          vec3 point(ivec2 p)
+          {
+            float d = float(texelFetch(depth, p, 0).r) / 1000.;
+            return vec3((vec2(p) - depth_K.zw) * d / depth_K.xy, d);
+          }
+          bool inlier(vec4 plane, vec3 p)
+          {
+            return p.z > 0. && dot(plane.xyz, plane.xyz) > 0. && abs(dot(plane.xyz, p) + plane.w) < threshold;
+          }
+          uint hash(uint x)
+          {
+            x ^= x >> 16u;
+            x *= 0x7feb352du;
+            x ^= x >> 15u;
+            x *= 0x846ca68bu;
+            x ^= x >> 16u;
+            return x;
+          }
+          vec4 hypothesis(int h, ivec2 size)
+          {
+            uint s = hash(uint(h) ^ hash(seed));
+            int r = max(size.x / 8, 2);
+            for (int attempt = 0; attempt < 8; attempt++)
+            {
+              s = hash(s);
+              ivec2 a = ivec2(int(s % uint(size.x)), int((s >> 16u) % uint(size.y)));
+              s = hash(s);
+              ivec2 b = clamp(a + ivec2(int(s % uint(2 * r + 1)), int((s >> 16u) % uint(2 * r + 1))) - r, ivec2(0),
+                              size - 1);
+              s = hash(s);
+              ivec2 c = clamp(a + ivec2(int(s % uint(2 * r + 1)), int((s >> 16u) % uint(2 * r + 1))) - r, ivec2(0),
+                              size - 1);
+              vec3 pa = point(a);
+              vec3 pb = point(b);
+              vec3 pc = point(c);
+              vec3 n = cross(pb - pa, pc - pa);
+              if (pa.z <= 0. || pb.z <= 0. || pc.z <= 0. || dot(n, n) < 1e-12)
+                continue;
+              n = normalize(n);
+              float d = -dot(n, pa);
+              return d < 0. ? -vec4(n, d) : vec4(n, d);
+            }
+            return vec4(0.);
+          }
+          void main()
+          {
+            ivec2 size = textureSize(depth, 0);
+            ivec2 grid = (size + step - 1) / step;
+            ivec2 f = ivec2(gl_FragCoord.xy);
+            if (stage == 0)
+              result = hypothesis(f.x, size);
+            else if (stage == 1)
+            {
+              vec4 plane = texelFetch(hypotheses, ivec2(f.x, 0), 0);
+              float n = 0.;
+              for (int x = 0; x < grid.x; x++)
+                n += inlier(plane, point(ivec2(x, f.y) * step)) ? 1. : 0.;
+              result = vec4(n);
+            }
+            else if (stage == 2)
+            {
+              float n = 0.;
+              for (int y = 0; y < textureSize(scores, 0).y; y++)
+                n += texelFetch(scores, ivec2(f.x, y), 0).r;
+              result = vec4(n);
+            }
+            else if (stage == 3)
+            {
+              float most = 0.;
+              vec4 best = vec4(0.);
+              for (int h = 0; h < textureSize(counts, 0).x; h++)
+              {
+                float n = texelFetch(counts, ivec2(h, 0), 0).r;
+                if (n > most)
+                {
+                  most = n;
+                  best = texelFetch(hypotheses, ivec2(h, 0), 0);
+                }
+              }
+              vec3 sum = vec3(0.);
+              float n = 0.;
+              for (int y = 0; y < grid.y; y++)
+                for (int x = 0; x < grid.x; x++)
+                {
+                  vec3 p = point(ivec2(x, y) * step);
+                  if (inlier(best, p))
+                  {
+                    sum += p;
+                    n += 1.;
+                  }
+                }
+              vec4 plane = best;
+              if (n >= 3.)
+              {
+                vec3 m = sum / n;
+                mat3 covariance = mat3(0.);
+                for (int y = 0; y < grid.y; y++)
+                  for (int x = 0; x < grid.x; x++)
+                  {
+                    vec3 p = point(ivec2(x, y) * step);
+                    if (inlier(best, p))
+                      covariance += outerProduct(p - m, p - m);
+                  }
+                mat3 flipped = mat3(covariance[0][0] + covariance[1][1] + covariance[2][2]) - covariance;
+                vec3 v = best.xyz;
+                for (int i = 0; i < 16; i++)
+                  v = normalize(flipped * v);
+                float d = -dot(v, m);
+                plane = d < 0. ? -vec4(v, d) : vec4(v, d);
+              }
+              result = plane;
+            }
+            else
+              result = vec4(inlier(texelFetch(hypotheses, ivec2(0), 0), point(f)) ? 1. : 0.);
+          }
+      );
+      program.reset(new GlProgram(vertexShader, fragmentShader));
+      stage = glGetUniformLocation(program->program, "stage");
+      depth = glGetUniformLocation(program->program, "depth");
+      hypotheses = glGetUniformLocation(program->program, "hypotheses");
+      scores = glGetUniformLocation(program->program, "scores");
+      counts = glGetUniformLocation(program->program, "counts");
+      depth_K = glGetUniformLocation(program->program, "depth_K");
+      threshold = glGetUniformLocation(program->program, "threshold");
+      step = glGetUniformLocation(program->program, "step");
+      seed = glGetUniformLocation(program->program, "seed");
+
+      CHECK_GLUT_ERROR
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint stage, depth, hypotheses, scores, counts, depth_K, threshold, step, seed;
+  };
+
+  /**
+   * The dominant plane of a depth frame by RANSAC on the GPU, see
+   * PlaneProgram. Hypotheses are scored on a grid of every STEP-th pixel, and
+   * the random samples change from frame to frame.
+   */
+  struct PlaneFit: boost::noncopyable
+  {
+    static const int STEP = 4;
+
+    PlaneFit()
+        :
+          hypotheses_count(256),
+          seed(0)
+    {
+    }
+
+    /** Fit the plane of the frame, whose millimeters are in depth_texture. */
+    void
+    fit(GLuint depth_texture, const CloudFrame& f, const PlaneProgram& program, float threshold)
+    {
+      int rows = (f.depth_height + STEP - 1) / STEP;
+      glUseProgram(program.program->program);
+      glUniform1i(program.depth, 0);
+      glUniform1i(program.hypotheses, 1);
+      glUniform1i(program.scores, 2);
+      glUniform1i(program.counts, 3);
+      glUniform4fv(program.depth_K, 1, f.depth_K.data());
+      glUniform1f(program.threshold, threshold);
+      glUniform1i(program.step, STEP);
+      glUniform1ui(program.seed, ++seed);
+      run(program, 0, hypotheses, hypotheses_count, 1, GL_RGBA32F, GL_RGBA, depth_texture, 0, 0, 0);
+      run(program, 1, scores, hypotheses_count, rows, GL_R32F, GL_RED, depth_texture, hypotheses.texture, 0, 0);
+      run(program, 2, counts, hypotheses_count, 1, GL_R32F, GL_RED, 0, 0, scores.texture, 0);
+      run(program, 3, plane, 1, 1, GL_RGBA32F, GL_RGBA, depth_texture, hypotheses.texture, 0, counts.texture);
+      run(program, 4, mask, f.depth_width, f.depth_height, GL_R8, GL_RED, depth_texture, plane.texture, 0, 0);
+      glUseProgram(0);
+
+      CHECK_GLUT_ERROR
+    }
+
+    int hypotheses_count;
+    unsigned seed;
+    PixelPass hypotheses, scores, counts;
+    PixelPass plane; //1x1, the plane
+    PixelPass mask; //R8, 1 at the plane's inliers
+
+  private:
+    /** Run a stage into pass with the given textures on units 0 to 3; a pass never reads its own target. */
+    void
+    run(const PlaneProgram& program, int stage, PixelPass& pass, int w, int h, GLenum internal_format, GLenum format,
+        GLuint depth, GLuint hypotheses, GLuint scores, GLuint counts)
+    {
+      //a pass that allocates unbinds the active unit, so inputs are bound after.
+      pass.begin(w, h, internal_format, format, GL_FLOAT);
+      GLuint inputs[4] =
+      { depth, hypotheses, scores, counts };
+      for (int i = 0; i < 4; i++)
+      {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, inputs[i]);
+      }
+      glUniform1i(program.stage, stage);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+      for (int i = 3; i >= 0; i--)
+      {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, 0);
+      }
+      pass.end();
+    }
+  };
+
+  /** How CloudData::draw() draws a frame. */
+  struct CloudStyle
+  {
+    CloudStyle()
+        :
+          shade(false),
+          max_jump(0),
+          mesh_step(0),
+          max_edge(.05f),
+          color(CloudProgram::RGB),
+          up(0, -1, 0),
+          color_range(0, 5),
+          plane_threshold(0)
+    {
+    }
+    bool shade; //Lambert shade by the normal map from CloudData::updateNormals(), lit from the viewer
+    float max_jump; //drop flying pixels, see CloudProgram, 0 for none
+    int mesh_step; //with a mesh program, draw a mesh over every mesh_step-th pixel instead of points, 0 for points
+    float max_edge; //drop mesh triangles with an edge longer than this times its depth
+    int color; //a CloudProgram::ColorMode; NORMAL needs the normal map from CloudData::updateNormals()
+    Eigen::Vector3f up; //the world direction HEIGHT measures along
+    Eigen::Vector2f color_range; //the meters of depth or height mapped to the ends of the colormap
+    float plane_threshold; //highlight points this close to the plane from CloudData::updatePlane(), 0 for none
+  };
+
+  /**
+   * Nearest and farthest valid depth of each tile x tile block of a depth
+   * image, row by row of blocks, 0 for blocks without depth.
+   */
+  inline void
+  depthTileRanges(const uint16_t* depth, int width, int height, int tile, std::vector<uint16_t>& nearest,
+                  std::vector<uint16_t>& farthest)
+  {
+    int tiles_x = (width + tile - 1) / tile, tiles_y = (height + tile - 1) / tile;
+    nearest.assign(tiles_x * tiles_y, 0);
+    farthest.assign(tiles_x * tiles_y, 0);
+    for (int ty = 0; ty < tiles_y; ty++)
+      for (int tx = 0; tx < tiles_x; tx++)
+      {
+        int x0 = tx * tile, x1 = std::min(width, x0 + tile), y1 = std::min(height, (ty + 1) * tile);
+        //d - 1 wraps the invalid 0 to the largest value, out of the way of the minimum.
+        uint16_t lo = 0xffff, hi = 0;
+        for (int y = ty * tile; y < y1; y++)
+        {
+          const uint16_t* row = depth + y * width;
+          int x = x0;
+#ifdef __SSE2__
+          //SSE2 only compares signed shorts, so flip the sign bits to order them as unsigned.
+          const __m128i one = _mm_set1_epi16(1), sign = _mm_set1_epi16(short(0x8000));
+          __m128i vlo = _mm_set1_epi16(0x7fff), vhi = _mm_set1_epi16(short(0x8000));
+          for (; x + 8 <= x1; x += 8)
+          {
+            __m128i d = _mm_loadu_si128((const __m128i *) (row + x));
+            vlo = _mm_min_epi16(vlo, _mm_xor_si128(_mm_sub_epi16(d, one), sign));
+            vhi = _mm_max_epi16(vhi, _mm_xor_si128(d, sign));
+          }
+          uint16_t los[8], his[8];
+          _mm_storeu_si128((__m128i *) los, _mm_xor_si128(vlo, sign));
+          _mm_storeu_si128((__m128i *) his, _mm_xor_si128(vhi, sign));
+          for (int k = 0; k < 8; k++)
+          {
+            lo = std::min(lo, los[k]);
+            hi = std::max(hi, his[k]);
+          }
+#endif
+          for (; x < x1; x++)
+          {
+            lo = std::min(lo, uint16_t(row[x] - 1));
+            hi = std::max(hi, row[x]);
+          }
+        }
+        nearest[ty * tiles_x + tx] = lo + 1;
+        farthest[ty * tiles_x + tx] = hi;
+      }
+  }
+
+  /** depthTileRanges() of samples in another format, by their millimeters. */
+  template<typename Sample, typename Millimeters>
+  void
+  sampleTileRanges(const Sample* depth, int width, int height, int tile, const Millimeters& millimeters,
+                   std::vector<uint16_t>& nearest, std::vector<uint16_t>& farthest)
+  {
+    int tiles_x = (width + tile - 1) / tile, tiles_y = (height + tile - 1) / tile;
+    nearest.assign(tiles_x * tiles_y, 0);
+    farthest.assign(tiles_x * tiles_y, 0);
+    for (int ty = 0; ty < tiles_y; ty++)
+      for (int tx = 0; tx < tiles_x; tx++)
+      {
+        int x0 = tx * tile, x1 = std::min(width, x0 + tile), y1 = std::min(height, (ty + 1) * tile);
+        uint16_t lo = 0xffff, hi = 0;
+        for (int y = ty * tile; y < y1; y++)
+          for (int x = x0; x < x1; x++)
+          {
+            uint16_t d = millimeters(depth[y * width + x]);
+            lo = std::min(lo, uint16_t(d - 1));
+            hi = std::max(hi, d);
+          }
+        nearest[ty * tiles_x + tx] = lo + 1;
+        farthest[ty * tiles_x + tx] = hi;
+      }
+  }
+
+  /** Millimeters of every raw disparity level, as DepthConvertProgram maps them. */
+  struct DisparityMillimeters
+  {
+    DisparityMillimeters()
+        :
+          levels(DISPARITY_LEVELS)
+    {
+      for (int i = 0; i < DISPARITY_LEVELS; i++)
+        levels[i] = metersToMillimeters(kinectDisparityMeters(i));
+    }
+    uint16_t
+    operator()(uint16_t disparity) const
+    {
+      return levels[std::min(int(disparity), DISPARITY_LEVELS - 1)];
+    }
+    std::vector<uint16_t> levels;
+  };
+
+  /**
+   * depthTileRanges() of a frame in any format, in the millimeters it has on
+   * the GPU, from its samples on the CPU.
+   */
+  inline void
+  frameTileRanges(const CloudFrame& f, int tile, std::vector<uint16_t>& nearest, std::vector<uint16_t>& farthest)
+  {
+    static const DisparityMillimeters disparity;
+    if (f.depth_format == DEPTH_METERS)
+      sampleTileRanges(f.depth_meters->data(), f.depth_width, f.depth_height, tile, metersToMillimeters, nearest,
+                       farthest);
+    else if (f.depth_format == DEPTH_DISPARITY)
+      sampleTileRanges(f.depth->data(), f.depth_width, f.depth_height, tile, disparity, nearest, farthest);
+    else
+      depthTileRanges(f.depth->data(), f.depth_width, f.depth_height, tile, nearest, farthest);
+  }
+
+  /**
+   * Depth goes in as a vertex buffer, one vertex per depth pixel. Color goes in
+   * as a texture at its native resolution, so a high resolution color camera
+   * needs no resize on the CPU.
+   */
+  struct CloudData: boost::noncopyable
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+//    static const size_t PER_UV = 2; //U,V
+//    static const size_t STEP_UV = PER_UV * sizeof(float); // the step from one point start to the next
+
+    static const size_t PER_DEPTH = 1; //depth
+    static const size_t STEP_DEPTH = PER_DEPTH * sizeof(uint16_t); // the step from one point start to the next
+
+    CloudData()
+        :
+          depth_buffer(0),
+          rgb_texture(0),
+          depth_bytes(0),
+          texture_width(0),
+          texture_height(0),
+          texture_channels(0),
+          bytes_uploaded(0),
+          frames_uploaded(0),
+          depth_texture(0),
+          depth_texture_width(0),
+          depth_texture_height(0),
+          mesh_indices(0),
+          mesh_width(0),
+          mesh_height(0),
+          mesh_step(0),
+          mesh_count(0),
+          raw_texture(0),
+          raw_width(0),
+          raw_height(0),
+          raw_format(0)
+    {
+
+    }
+    ~CloudData()
+    {
+      glDeleteBuffers(1, &depth_buffer);
+      glDeleteTextures(1, &rgb_texture);
+      glDeleteTextures(1, &depth_texture);
+      glDeleteBuffers(1, &mesh_indices);
+      glDeleteTextures(1, &raw_texture);
+
+      CHECK_GLUT_ERROR
+    }
+    void
+    setDepth(const DepthData& depth)
+    {
+      if (!glIsBuffer(depth_buffer))
+      {
+        glGenBuffers(1, &depth_buffer);
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, depth_buffer);
+      //frames of the same size overwrite the buffer in place.
+      size_t bytes = sizeof(uint16_t) * depth.size();
+      if (bytes == depth_bytes)
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, depth.data());
+      else
+        glBufferData(GL_ARRAY_BUFFER, bytes, depth.data(), GL_DYNAMIC_DRAW);
+      depth_bytes = bytes;
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      CHECK_GLUT_ERROR
+
+
+    }
+
+    /** Upload a color image of 1 (gray), 3 (RGB) or 4 (RGBA) channels, reallocating only when its shape changes. */
+    void
+    setColor(const RgbData& rgb, int width, int height, int channels)
+    {
+      GLenum format = channels == 1 ? GL_RED : channels == 4 ? GL_RGBA : GL_RGB;
+      if (!rgb_texture)
+      {
+        glGenTextures(1, &rgb_texture);
+        glBindTexture(GL_TEXTURE_2D, rgb_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      }
+      glBindTexture(GL_TEXTURE_2D, rgb_texture);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      if (width != texture_width || height != texture_height || channels != texture_channels)
+      {
+        glTexImage2D(GL_TEXTURE_2D, 0, channels == 1 ? GL_R8 : channels == 4 ? GL_RGBA8 : GL_RGB8, width, height, 0,
+                     format, GL_UNSIGNED_BYTE, rgb.data());
+        texture_width = width;
+        texture_height = height;
+        texture_channels = channels;
+      }
+      else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, rgb.data());
+      glBindTexture(GL_TEXTURE_2D, 0);
+
+      CHECK_GLUT_ERROR
+    }
+
+    /**
+     * Upload a frame unless it is the one already on the GPU, so windows of a
+     * share group that display the same stream only pay for it once. Frames
+     * without a color image are for the color modes that do not need one.
+     * Frames in another depth format than millimeters need convert.
+     */
+    void
+    setData(const CloudFrame& f, const DepthConvertProgram* convert = 0)
+    {
+      if (!f.depth || (f.depth == frame.depth && f.rgb == frame.rgb))
+        return;
+      if (depthSamples(f) < size_t(f.depth_width * f.depth_height)
+          || (f.rgb && f.rgb->size() < size_t(f.image_width * f.image_height * f.image_channels)))
+      {
+        std::cerr << "Dropping a cloud frame smaller than its declared size." << std::endl;
+        return;
+      }
+      if (f.depth_format != DEPTH_MILLIMETERS && !convert)
+      {
+        std::cerr << "Dropping a cloud frame in another depth format than millimeters, with no program to convert it."
+                  << std::endl;
+        return;
+      }
+      frame = f;
+      if (f.depth_format == DEPTH_MILLIMETERS)
+        setDepth(*f.depth);
+      else
+        convertDepth(*convert);
+      frameTileRanges(f, TILE, tile_near, tile_far);
+      if (f.rgb)
+        setColor(*f.rgb, f.image_width, f.image_height, f.image_channels);
+      bytes_uploaded += uploadBytes(f);
+      ++frames_uploaded;
+    }
+
+    /**
+     * Upload depth in another format than millimeters as it is, and convert
+     * it to millimeters in the depth buffer on the GPU, so everything after
+     * the upload works the same for all formats.
+     */
+    void
+    convertDepth(const DepthConvertProgram& program)
+    {
+      int w = frame.depth_width, h = frame.depth_height;
+      bool meters = frame.depth_format == DEPTH_METERS;
+      if (!glIsBuffer(depth_buffer))
+        glGenBuffers(1, &depth_buffer);
+      size_t bytes = sizeof(uint16_t) * w * h;
+      if (bytes != depth_bytes)
+      {
+        glBindBuffer(GL_ARRAY_BUFFER, depth_buffer);
+        glBufferData(GL_ARRAY_BUFFER, bytes, 0, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        depth_bytes = bytes;
+      }
+
+      GLenum internal_format = meters ? GL_R32F : GL_R16UI;
+      GLenum format = meters ? GL_RED : GL_RED_INTEGER, type = meters ? GL_FLOAT : GL_UNSIGNED_SHORT;
+      const void* samples = meters ? (const void*) frame.depth_meters->data() : (const void*) frame.depth->data();
+      if (!raw_texture)
+      {
+        glGenTextures(1, &raw_texture);
+        glBindTexture(GL_TEXTURE_2D, raw_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      }
+      glBindTexture(GL_TEXTURE_2D, raw_texture);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, meters ? 4 : 2);
+      if (w != raw_width || h != raw_height || GLint(internal_format) != raw_format)
+      {
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, w, h, 0, format, type, samples);
+        raw_width = w;
+        raw_height = h;
+        raw_format = internal_format;
+      }
+      else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, format, type, samples);
+
+      converted.begin(w, h, GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT);
+      glUseProgram(program.program->program);
+      //samplers of different types need units of their own.
+      glActiveTexture(meters ? GL_TEXTURE1 : GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, raw_texture);
+      glActiveTexture(GL_TEXTURE2);
+      glBindTexture(GL_TEXTURE_2D, program.lut_texture);
+      glUniform1i(program.disparity, 0);
+      glUniform1i(program.meters, 1);
+      glUniform1i(program.lut, 2);
+      glUniform1i(program.from_meters, meters);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+      glUseProgram(0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glActiveTexture(meters ? GL_TEXTURE1 : GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glActiveTexture(GL_TEXTURE0);
+      converted.end();
+      writeDepth(converted);
+
+      CHECK_GLUT_ERROR
+    }
+
+    /** Copy the depth vertex buffer into depth_texture on the GPU, unless it is there already. */
+    void
+    copyDepthTexture()
+    {
+      if (texture_depth == frame.depth)
+        return;
+      int w = frame.depth_width, h = frame.depth_height;
+      if (!depth_texture)
+      {
+        glGenTextures(1, &depth_texture);
+        glBindTexture(GL_TEXTURE_2D, depth_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      }
+      glBindTexture(GL_TEXTURE_2D, depth_texture);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, depth_buffer);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+      if (w != depth_texture_width || h != depth_texture_height)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, w, h, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, 0);
+      else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RED_INTEGER, GL_UNSIGNED_SHORT, 0);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      depth_texture_width = w;
+      depth_texture_height = h;
+      texture_depth = frame.depth;
+    }
+
+    /**
+     * Bilaterally filter the frame's depth on the GPU, unless it already is,
+     * and write the result back into the depth vertex buffer, so everything
+     * drawn or computed from the frame afterwards sees the filtered depth.
+     * Each tile's depth range grows to those of its neighbors, which bound
+     * every value the filter can produce for a radius up to TILE.
+     */
+    void
+    updateFilter(const BilateralProgram& program, int radius, float sigma_space, float sigma_range)
+    {
+      if (!frame.depth || radius <= 0 || filtered_depth == frame.depth)
+        return;
+      int w = frame.depth_width, h = frame.depth_height;
+      copyDepthTexture();
+      filtered.begin(w, h, GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT);
+      glUseProgram(program.program->program);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, depth_texture);
+      glUniform1i(program.depth, 0);
+      glUniform1i(program.radius, std::min(radius, int(TILE)));
+      glUniform1f(program.space_k, .5f / (sigma_space * sigma_space));
+      //the range sigma is in meters, depth in millimeters.
+      glUniform1f(program.range_k, .5f / (sigma_range * sigma_range * 1e6f));
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+      glUseProgram(0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      filtered.end();
+      writeDepth(filtered);
+      widenTileRanges(true, 0);
+      filtered_depth = frame.depth;
+
+      CHECK_GLUT_ERROR
+    }
+
+    /**
+     * Replace the depth vertex buffer with the R16UI pixels of pass, on the
+     * GPU. depth_texture and the normal map are stale afterwards.
+     */
+    void
+    writeDepth(const PixelPass& pass)
+    {
+      GLint read_fbo = 0;
+      glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fbo);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, pass.fbo);
+      glReadBuffer(GL_COLOR_ATTACHMENT0);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, depth_buffer);
+      glPixelStorei(GL_PACK_ALIGNMENT, 2);
+      glReadPixels(0, 0, frame.depth_width, frame.depth_height, GL_RED_INTEGER, GL_UNSIGNED_SHORT, 0);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+      texture_depth.reset();
+      normals_depth.reset();
+      plane_depth.reset();
+
+      CHECK_GLUT_ERROR
+    }
+
+    /**
+     * Grow the depth range of every non empty tile, after the depth changed on
+     * the GPU, so culling stays conservative: to the ranges of its neighbors,
+     * and then by margin millimeters both ways.
+     */
+    void
+    widenTileRanges(bool neighbors, int margin)
+    {
+      int tiles_x = (frame.depth_width + TILE - 1) / TILE, tiles_y = (frame.depth_height + TILE - 1) / TILE;
+      std::vector<uint16_t> nearest(tile_near), farthest(tile_far);
+      for (int ty = 0; ty < tiles_y; ty++)
+        for (int tx = 0; tx < tiles_x; tx++)
+        {
+          int i = ty * tiles_x + tx;
+          if (!tile_far[i])
+            continue;
+          for (int y = std::max(ty - neighbors, 0); y <= std::min(ty + neighbors, tiles_y - 1); y++)
+            for (int x = std::max(tx - neighbors, 0); x <= std::min(tx + neighbors, tiles_x - 1); x++)
+            {
+              int j = y * tiles_x + x;
+              if (!tile_far[j])
+                continue;
+              nearest[i] = std::min(nearest[i], tile_near[j]);
+              farthest[i] = std::max(farthest[i], tile_far[j]);
+            }
+          nearest[i] = std::max(int(nearest[i]) - margin, 1);
+          farthest[i] = std::min(int(farthest[i]) + margin, 65535);
+        }
+      tile_near.swap(nearest);
+      tile_far.swap(farthest);
+    }
+
+    /**
+     * Render the normal map of the frame into normals.texture, unless it is up
+     * to date, from the depth as it is in the vertex buffer.
+     */
+    void
+    updateNormals(const NormalProgram& program, float max_jump = .05f)
+    {
+      if (!frame.depth || normals_depth == frame.depth)
+        return;
+      copyDepthTexture();
+      normals.begin(frame.depth_width, frame.depth_height, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+      glUseProgram(program.program->program);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, depth_texture);
+      glUniform1i(program.depth, 0);
+      glUniform4fv(program.depth_K, 1, frame.depth_K.data());
+      glUniform1f(program.max_jump, max_jump);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+      glUseProgram(0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      normals.end();
+      normals_depth = frame.depth;
+
+      CHECK_GLUT_ERROR
+    }
+
+    /**
+     * Fit the dominant plane of the frame into plane_fit, unless it is up to
+     * date, from the depth as it is in the vertex buffer.
+     */
+    void
+    updatePlane(const PlaneProgram& program, float threshold)
+    {
+      if (!frame.depth || plane_depth == frame.depth)
+        return;
+      copyDepthTexture();
+      plane_fit.fit(depth_texture, frame, program, threshold);
+      plane_depth = frame.depth;
+    }
+
+    /**
+     * The plane whose signed distance from a point in the depth camera frame
+     * is what a colormap color mode shows: its depth, or its height along the
+     * world direction up at the frame's pose.
+     */
+    Eigen::Vector4f
+    colorPlane(int color, const Eigen::Vector3f& up) const
+    {
+      if (color != CloudProgram::HEIGHT)
+        return Eigen::Vector4f(0, 0, 1, 0);
+      Eigen::Vector3f n = frame.pose.linear().transpose() * up;
+      return Eigen::Vector4f(n[0], n[1], n[2], up.dot(frame.pose.translation()));
+    }
+
+    /** Use the program with the frame's buffers and uniforms, and p as the projection. */
+    void
+    bind(const CloudProgram& program, const Eigen::Matrix4f& p, float fade)
+    {
+      glUseProgram(program.program->program);
+      glEnableVertexAttribArray(program.depthHandle);
+      glBindBuffer(GL_ARRAY_BUFFER, depth_buffer);
+      glVertexAttribPointer(program.depthHandle, PER_DEPTH, GL_UNSIGNED_SHORT, GL_FALSE, STEP_DEPTH, (void*) 0);
+      CHECK_GLUT_ERROR
+
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, rgb_texture);
+      glUniform1i(program.rgb, 0);
+      glUniform1i(program.gray, frame.image_channels == 1);
+      glUniform4fv(program.depth_K, 1, frame.depth_K.data());
+      glUniform4fv(program.image_K, 1, frame.image_K.data());
+      glUniformMatrix4fv(program.depth_to_image, 1, false, frame.depth_to_image.matrix().data());
+      glUniform2f(program.image_size, frame.image_width, frame.image_height);
+      glUniform1i(program.depth_width, frame.depth_width);
+      glUniform1f(program.fade, fade);
+      glUniformMatrix4fv(program.projection_modelview, 1, false, p.data());
+      glUniform1i(program.shade, false);
+      glUniform1i(program.normals, 1);
+      glUniform1i(program.edges, 2);
+      glUniform1f(program.max_jump, 0.f);
+      glUniform1i(program.color_mode, CloudProgram::RGB);
+      glUniform1i(program.colormap, 3);
+      glUniform1i(program.plane, 4);
+      glUniform1f(program.plane_threshold, 0.f);
+
+      CHECK_GLUT_ERROR
+    }
+
+    /** Color the next draw with the bound program as style says. */
+    void
+    setColorMode(const CloudProgram& program, const CloudStyle& style)
+    {
+      bool normals_ready = normals_depth == frame.depth;
+      if ((style.shade || style.color == CloudProgram::NORMAL) && normals_ready)
+      {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, normals.texture);
+      }
+      glActiveTexture(GL_TEXTURE3);
+      glBindTexture(GL_TEXTURE_2D, program.colormap_texture);
+      glActiveTexture(GL_TEXTURE0);
+      glUniform1i(program.color_mode, style.color);
+      Eigen::Vector4f plane = colorPlane(style.color, style.up);
+      glUniform4fv(program.color_plane, 1, plane.data());
+      glUniform2f(program.color_range, style.color_range[0],
+                  std::max(style.color_range[1] - style.color_range[0], 1e-6f));
+      Eigen::Matrix3f rotation = frame.pose.linear();
+      glUniformMatrix3fv(program.normal_to_world, 1, false, rotation.data());
+    }
+
+    /** Drop flying pixels from the next draw with the bound program, for max_jump above 0. */
+    void
+    rejectEdges(const CloudProgram& program, float max_jump)
+    {
+      if (max_jump <= 0)
+        return;
+      glActiveTexture(GL_TEXTURE2);
+      glBindTexture(GL_TEXTURE_2D, depth_texture);
+      glActiveTexture(GL_TEXTURE0);
+      glUniform1f(program.max_jump, max_jump);
+    }
+
+    void
+    unbind(const CloudProgram& program)
+    {
+      glActiveTexture(GL_TEXTURE4);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glActiveTexture(GL_TEXTURE3);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glActiveTexture(GL_TEXTURE2);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glActiveTexture(GL_TEXTURE0);
+      glDisableVertexAttribArray(program.depthHandle);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glUseProgram(0);
+    }
+
+    /**
+     * Draw the cloud at its pose as style says, with colors scaled by fade.
+     * Points are drawn from the tiles that survive culling; a mesh, with a
+     * program made with mesh set, as triangle strips along the rows of the
+     * depth grid. Returns the vertices drawn.
+     */
+    size_t
+    draw(const CloudProgram& program, const Camera& c, const CloudStyle& style = CloudStyle(), float fade = 1.f)
+    {
+      if (!frame.depth)
+        return 0;
+      if (style.max_jump > 0)
+        copyDepthTexture();
+      glViewport(c.vpX(), c.vpY(), c.vpWidth(), c.vpHeight());
+      bind(program, c.projectionMatrix() * c.viewMatrix().matrix() * frame.pose.matrix(), fade);
+      rejectEdges(program, style.max_jump);
+      setColorMode(program, style);
+      if (style.plane_threshold > 0 && plane_depth == frame.depth)
+      {
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, plane_fit.plane.texture);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1f(program.plane_threshold, style.plane_threshold);
+      }
+      if (style.shade && normals_depth == frame.depth)
+      {
+        glUniform1i(program.shade, true);
+        Eigen::Vector3f light = frame.pose.inverse() * c.position();
+        glUniform3fv(program.light, 1, light.data());
+      }
+      size_t drawn = 0;
+      if (program.mesh && style.mesh_step > 0)
+      {
+        drawn = updateMesh(style.mesh_step);
+        glUniform1f(program.max_edge, style.max_edge);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_indices);
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(MESH_RESTART);
+        glDrawElements(GL_TRIANGLE_STRIP, mesh_count, GL_UNSIGNED_INT, 0);
+        glDisable(GL_PRIMITIVE_RESTART);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      }
+      else
+      {
+        glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+        drawn = cull(c);
+        if (firsts.size() == 1)
+          glDrawArrays(GL_POINTS, firsts[0], counts[0]);
+        else if (!firsts.empty())
+          glMultiDrawArrays(GL_POINTS, firsts.data(), counts.data(), firsts.size());
+        glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+      }
+      CHECK_GLUT_ERROR
+      unbind(program);
+
+      CHECK_GLUT_ERROR
+      return drawn;
+    }
+
+    static const uint32_t MESH_RESTART = 0xffffffff;
+
+    /**
+     * Build the index buffer of the mesh over every step-th pixel, unless it
+     * is built for this resolution and step: a triangle strip for each pair
+     * of sampled rows, separated by the restart index. Vertex ids are pixel
+     * indices, so the mesh draws straight from the depth buffer. Returns the
+     * number of pixels sampled.
+     */
+    size_t
+    updateMesh(int step)
+    {
+      int w = frame.depth_width, h = frame.depth_height;
+      int cols = (w - 1) / step + 1, rows = (h - 1) / step + 1;
+      if (mesh_indices && w == mesh_width && h == mesh_height && step == mesh_step)
+        return size_t(cols) * rows;
+      std::vector<uint32_t> indices;
+      indices.reserve(size_t(rows - 1) * (2 * cols + 1));
+      for (int r = 0; r + 1 < rows; r++)
+      {
+        for (int x = 0; x < cols; x++)
+        {
+          indices.push_back(r * step * w + x * step);
+          indices.push_back((r + 1) * step * w + x * step);
+        }
+        indices.push_back(uint32_t(MESH_RESTART));
+      }
+      if (!mesh_indices)
+        glGenBuffers(1, &mesh_indices);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_indices);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      mesh_width = w;
+      mesh_height = h;
+      mesh_step = step;
+      mesh_count = indices.size();
+
+      CHECK_GLUT_ERROR
+      return size_t(cols) * rows;
+    }
+
+    static const size_t FEEDBACK_STEP = 4 * sizeof(float); //x, y, z and packed_rgb of one point
+
+    /**
+     * Unproject every pixel of the frame into buffer by transform feedback,
+     * FEEDBACK_STEP bytes each in image order, using a program made with
+     * feedback set. Nothing is rasterized. Flying pixels come out as holes
+     * for max_jump above 0.
+     */
+    void
+    feedback(const CloudProgram& program, GLuint buffer, float max_jump = 0)
+    {
+      if (!frame.depth)
+        return;
+      if (max_jump > 0)
+        copyDepthTexture();
+      bind(program, Eigen::Matrix4f::Identity(), 1.f);
+      rejectEdges(program, max_jump);
+      glEnable(GL_RASTERIZER_DISCARD);
+      glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer);
+      glBeginTransformFeedback(GL_POINTS);
+      glDrawArrays(GL_POINTS, 0, frame.depth_width * frame.depth_height);
+      glEndTransformFeedback();
+      glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+      glDisable(GL_RASTERIZER_DISCARD);
+      unbind(program);
+
+      CHECK_GLUT_ERROR
+    }
+
+    /**
+     * Fill firsts and counts with the vertex ranges of the tiles that may be in
+     * the camera's view. A tile's points lie in the frustum of its pixels
+     * between its nearest and farthest depth, so it is skipped when all 8
+     * corners of that are outside one clip plane. Runs of visible tiles merge
+     * into single ranges, down to one for a fully visible frame. Returns the
+     * number of vertices in the ranges.
+     */
+    size_t
+    cull(const Camera& c)
+    {
+      Eigen::Vector4f planes[6];
+      c.frustumPlanes(planes);
+      //in the depth camera's frame: p . (pose x) = (pose^T p) . x
+      for (int i = 0; i < 6; i++)
+        planes[i] = frame.pose.matrix().transpose() * planes[i];
+      const Eigen::Vector4f& K = frame.depth_K;
+      int w = frame.depth_width, h = frame.depth_height;
+      int tiles_x = (w + TILE - 1) / TILE, tiles_y = (h + TILE - 1) / TILE;
+      firsts.clear();
+      counts.clear();
+      size_t drawn = 0;
+      for (int ty = 0; ty < tiles_y; ty++)
+      {
+        int y0 = ty * TILE, y1 = std::min(h, y0 + TILE);
+        visible.assign(tiles_x, false);
+        for (int tx = 0; tx < tiles_x; tx++)
+        {
+          uint16_t nearest = tile_near[ty * tiles_x + tx], farthest = tile_far[ty * tiles_x + tx];
+          if (!farthest)
+            continue;
+          int x0 = tx * TILE, x1 = std::min(w, x0 + TILE);
+          Eigen::Vector4f corners[8];
+          for (int k = 0; k < 8; k++)
+          {
+            float u = k & 1 ? x1 - 1 : x0, v = k & 2 ? y1 - 1 : y0, d = (k & 4 ? farthest : nearest) / 1000.f;
+            corners[k] = Eigen::Vector4f((u - K[2]) * d / K[0], (v - K[3]) * d / K[1], d, 1);
+          }
+          bool inside = true;
+          for (int i = 0; i < 6 && inside; i++)
+          {
+            int k = 0;
+            while (k < 8 && planes[i].dot(corners[k]) < 0)
+              k++;
+            inside = k < 8;
+          }
+          visible[tx] = inside;
+        }
+        for (int y = y0; y < y1; y++)
+          for (int tx = 0; tx < tiles_x; tx++)
+          {
+            if (!visible[tx])
+              continue;
+            GLint first = y * w + tx * TILE;
+            GLsizei count = std::min(w, (tx + 1) * TILE) - tx * TILE;
+            drawn += count;
+            if (!firsts.empty() && firsts.back() + counts.back() == first)
+              counts.back() += count;
+            else
+            {
+              firsts.push_back(first);
+              counts.push_back(count);
+            }
+          }
+      }
+      return drawn;
+    }
+
+    static const int TILE = 32; //pixels on a side of a culling tile
+
+    std::vector<float> uvs;
+    GLuint uv_buffer, depth_buffer, rgb_texture;
+    size_t depth_bytes;
+    int texture_width, texture_height, texture_channels;
+    CloudFrame frame; //the frame currently on the GPU
+    size_t bytes_uploaded, frames_uploaded;
+    std::vector<uint16_t> tile_near, tile_far; //depth range of each tile, in mm
+    std::vector<GLint> firsts;
+    std::vector<GLsizei> counts;
+    std::vector<bool> visible;
+    GLuint depth_texture; //a copy of the depth buffer, for the pixel passes
+    int depth_texture_width, depth_texture_height;
+    PixelPass filtered, normals;
+    DepthDataConstPtr texture_depth; //the frame depth_texture holds as in the depth buffer
+    DepthDataConstPtr filtered_depth; //the frame the depth buffer holds filtered
+    DepthDataConstPtr normals_depth; //the frame normals were computed from
+    GLuint mesh_indices;
+    int mesh_width, mesh_height, mesh_step;
+    GLsizei mesh_count;
+    GLuint raw_texture; //depth as uploaded, for formats other than millimeters
+    int raw_width, raw_height;
+    GLint raw_format;
+    PixelPass converted;
+    PlaneFit plane_fit;
+    DepthDataConstPtr plane_depth; //the frame plane_fit was fit to
+  };
+
+  /**
+   * One step of an exponential moving average of depth: the new depth gets
+   * weight alpha where it is within motion millimeters of the average, and
+   * rises smoothly to 1 beyond, so moving surfaces follow at once instead of
+   * smearing. A hole leaves the average as it was. Writes the average to a
+   * float state and its rounded value, 0 at holes, to an R16UI target.
+   */
+  struct TemporalProgram
+  {
+    TemporalProgram()
+    {
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          void main()
+          {
+            vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+            gl_Position = vec4(corner * 2. - 1., 0., 1.);
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          uniform usampler2D depth;
+          uniform sampler2D average;
+          uniform float alpha;
+          uniform float motion;
+          out vec4 state;
+          out uvec4 rounded;
+          void main()
+          {
+            ivec2 p = ivec2(gl_FragCoord.xy);
+            float d = float(texelFetch(depth, p, 0).r);
+            float a = texelFetch(average, p, 0).r;
+            if (d == 0.)
+            {
+              state = vec4(a);
+              rounded = uvec4(0u);
+              return;
+            }
+            float w = a > 0. ? mix(alpha, 1., smoothstep(0., motion, abs(d - a))) : 1.;
+            float s = mix(a, d, w);
+            state = vec4(s);
+            rounded = uvec4(uint(s + .5));
+          }
+      );
+      program.reset(new GlProgram(vertexShader, fragmentShader));
+      depth = glGetUniformLocation(program->program, "depth");
+      average = glGetUniformLocation(program->program, "average");
+      alpha = glGetUniformLocation(program->program, "alpha");
+      motion = glGetUniformLocation(program->program, "motion");
+      state_output = glGetFragDataLocation(program->program, "state");
+      rounded_output = glGetFragDataLocation(program->program, "rounded");
+
+      CHECK_GLUT_ERROR
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint depth, average, alpha, motion;
+    GLint state_output, rounded_output;
+  };
+
+  /**
+   * A temporal depth filter for a static sensor. The running average lives on
+   * the GPU in two float textures that take turns being read and written, and
+   * every new frame is averaged in once and written back into its cloud's
+   * depth buffer, so the filtered cloud is drawn with no CPU round trip.
+   */
+  struct TemporalFilter: boost::noncopyable
+  {
+    TemporalFilter()
+        :
+          current(0)
+    {
+      states[0] = states[1] = 0;
+    }
+    ~TemporalFilter()
+    {
+      glDeleteTextures(2, states);
+    }
+
+    /** Average the cloud's frame in, unless it is the frame averaged last. alpha is the weight of the new frame. */
+    void
+    apply(CloudData& cloud, const TemporalProgram& program, float alpha, float motion)
+    {
+      const CloudFrame& f = cloud.frame;
+      if (!f.depth || f.depth == last_depth)
+        return;
+      int w = f.depth_width, h = f.depth_height;
+      cloud.copyDepthTexture();
+      bool resized = w != rounded.width || h != rounded.height;
+      rounded.begin(w, h, GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT);
+      if (!states[0] || resized)
+      {
+        //a new resolution starts over from the frame itself.
+        if (!states[0])
+          glGenTextures(2, states);
+        std::vector<float> zeros(w * h, 0.f);
+        for (int i = 0; i < 2; i++)
+        {
+          glBindTexture(GL_TEXTURE_2D, states[i]);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+          glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+          glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, &zeros[0]);
+        }
+      }
+      int next = 1 - current;
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, states[next], 0);
+      GLenum buffers[2];
+      buffers[program.rounded_output] = GL_COLOR_ATTACHMENT0;
+      buffers[program.state_output] = GL_COLOR_ATTACHMENT1;
+      glDrawBuffers(2, buffers);
+
+      glUseProgram(program.program->program);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, cloud.depth_texture);
+      glUniform1i(program.depth, 0);
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_2D, states[current]);
+      glUniform1i(program.average, 1);
+      glUniform1f(program.alpha, alpha);
+      //motion is in meters, depth in millimeters.
+      float motion_mm = std::max(motion * 1000.f, 1.f);
+      glUniform1f(program.motion, motion_mm);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+      glUseProgram(0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+
+      //the pass only reads and writes its first attachment otherwise.
+      glDrawBuffers(1, buffers + program.rounded_output);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+      rounded.end();
+      cloud.writeDepth(rounded);
+      //where the average differs by more than motion the new depth is taken as is.
+      cloud.widenTileRanges(false, motion_mm + 1);
+      current = next;
+      last_depth = f.depth;
+
+      CHECK_GLUT_ERROR
+    }
+
+    PixelPass rounded;
+    GLuint states[2];
+    int current; //the state holding the average so far
+    DepthDataConstPtr last_depth;
+  };
+
+  /**
+   * Reduces the values dot(plane.xyz, p) + plane.w of the points p of a depth
+   * frame, in the depth camera frame, to their minimum and maximum in RG32F.
+   * The first pass takes block x block depth pixels to each output texel,
+   * the later ones block x block texels of the pass before. Texels without
+   * points hold (1e30, -1e30).
+   */
+  struct RangeProgram
+  {
+    RangeProgram()
+    {
+      static const char vertexShader[] = "#version 130\n" SHADER_STR(
+          void main()
+          {
+            vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+            gl_Position = vec4(corner * 2. - 1., 0., 1.);
+          }
+      );
+
+      static const char fragmentShader[] = "#version 130\n" SHADER_STR(
+          uniform usampler2D depth;
+          uniform sampler2D ranges;
+          uniform bool from_depth;
+          uniform vec4 depth_K;
+          uniform vec4 plane;
+          uniform int block;
+          out vec2 range;
+          void main()
+          {
+            ivec2 first = ivec2(gl_FragCoord.xy) * block;
+            ivec2 last = min(first + block, from_depth ? textureSize(depth, 0) : textureSize(ranges, 0));
+            vec2 r = vec2(1e30, -1e30);
+            for (int y = first.y; y < last.y; y++)
+              for (int x = first.x; x < last.x; x++)
+                if (from_depth)
+                {
+                  float d = float(texelFetch(depth, ivec2(x, y), 0).r) / 1000.;
+                  if (d > 0.)
+                  {
+                    vec3 p = vec3((float(x) - depth_K[2]) * d / depth_K[0], (float(y) - depth_K[3]) * d / depth_K[1], d);
+                    float v = dot(plane.xyz, p) + plane.w;
+                    r = vec2(min(r.x, v), max(r.y, v));
+                  }
+                }
+                else
+                {
+                  vec2 b = texelFetch(ranges, ivec2(x, y), 0).rg;
+                  r = vec2(min(r.x, b.x), max(r.y, b.y));
+                }
+            range = r;
+          }
+      );
+      program.reset(new GlProgram(vertexShader, fragmentShader));
+      depth = glGetUniformLocation(program->program, "depth");
+      ranges = glGetUniformLocation(program->program, "ranges");
+      from_depth = glGetUniformLocation(program->program, "from_depth");
+      depth_K = glGetUniformLocation(program->program, "depth_K");
+      plane = glGetUniformLocation(program->program, "plane");
+      block = glGetUniformLocation(program->program, "block");
+
+      CHECK_GLUT_ERROR
+    }
+    boost::shared_ptr<GlProgram> program;
+    GLint depth, ranges, from_depth, depth_K, plane, block;
+  };
+
+  /**
+   * Auto-ranging for the colormap color modes: the range of the depth or
+   * height of a cloud's points, reduced on the GPU and read back a frame or
+   * more later, so the render thread never waits for it.
+   */
+  struct ValueRange: boost::noncopyable
+  {
+    static const int LEVELS = 4, BLOCK = 8; //passes for up to 4096 pixels a side, the CPU finishes the rest
+
+    ValueRange()
+        :
+          range(0, 5),
+          valid(false),
+          reduced_plane(Eigen::Vector4f::Zero())
+    {
+    }
+    ~ValueRange()
+    {
+      readback.release();
+    }
+
+    /**
+     * Take in a finished reduction, and start one for the cloud's frame and
+     * plane, see CloudData::colorPlane(), unless it was started already.
+     * Returns whether range holds a result yet.
+     */
+    bool
+    update(CloudData& cloud, const RangeProgram& program, const Eigen::Vector4f& plane)
+    {
+      cv::Mat texels;
+      if (readback.finish(texels))
+      {
+        float lo = 1e30f, hi = -1e30f;
+        const float* t = texels.ptr<float>();
+        for (size_t i = 0; i < texels.total(); i++, t += 2)
+        {
+          lo = std::min(lo, t[0]);
+          hi = std::max(hi, t[1]);
+        }
+        if (lo <= hi)
+        {
+          range = Eigen::Vector2f(lo, hi);
+          valid = true;
+        }
+      }
+      const CloudFrame& f = cloud.frame;
+      if (!f.depth || readback.fence || (f.depth == reduced_depth && plane == reduced_plane))
+        return valid;
+      cloud.copyDepthTexture();
+      glUseProgram(program.program->program);
+      glUniform1i(program.depth, 0);
+      glUniform1i(program.ranges, 1);
+      glUniform4fv(program.depth_K, 1, f.depth_K.data());
+      glUniform4fv(program.plane, 1, plane.data());
+      glUniform1i(program.block, BLOCK);
+      int w = f.depth_width, h = f.depth_height, last = 0;
+      for (int level = 0; level < LEVELS; level++)
+      {
+        w = (w + BLOCK - 1) / BLOCK;
+        h = (h + BLOCK - 1) / BLOCK;
+        //a pass that allocates unbinds the active unit, so inputs are bound after.
+        levels[level].begin(w, h, GL_RG32F, GL_RG, GL_FLOAT);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, cloud.depth_texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, level ? levels[level - 1].texture : 0);
+        glUniform1i(program.from_depth, level == 0);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        levels[level].end();
+        last = level;
+        if (w == 1 && h == 1)
+          break;
+      }
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glUseProgram(0);
+      readback.start(levels[last], GL_RG, GL_FLOAT, CV_32FC2);
+      reduced_depth = f.depth;
+      reduced_plane = plane;
+
+      CHECK_GLUT_ERROR
+      return valid;
+    }
+
+    Eigen::Vector2f range; //nearest and farthest, or lowest and highest, in meters
+    bool valid;
+    PixelPass levels[LEVELS];
+    PassReadback readback;
+    DepthDataConstPtr reduced_depth;
+    Eigen::Matrix<float, 4, 1, Eigen::DontAlign> reduced_plane;
+  };
+}
@@ -1,8 +1,17 @@
 #pragma once
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <deque>
+#include <iosfwd>
+#include <map>
 #include <string>
+#include <vector>
 #include "camera.h"
-#include <GL/gl.h>
+#include <Eigen/StdVector>
+#include <GL/glew.h>
 
 namespace ecto_gl
 {
@@ -16,20 +25,120 @@ namespace ecto_gl
     int modifiers;
   };
 
+  /**
+   * Windows in the same share group render with one GL context, so programs,
+   * textures and buffers created through resource() exist once for the whole
+   * group and data uploaded by one window can be drawn by all of them.
+   */
+  class ShareGroup: boost::noncopyable
+  {
+  public:
+    typedef boost::shared_ptr<ShareGroup> ptr;
+
+    /** Look up a named group, creating it if needed. An empty name gives a new private group. */
+    static ptr
+    get(const std::string& name);
+
+    /** Get or lazily create the shared resource stored under key. Needs the group context current. */
+    template<typename T>
+    boost::shared_ptr<T>
+    resource(const std::string& key)
+    {
+      boost::mutex::scoped_lock lock(mtx_);
+      boost::shared_ptr<void>& r = resources_[key];
+      if (!r)
+        r.reset(new T);
+      return boost::static_pointer_cast<T>(r);
+    }
+
+    /** Drop all resources, called with the group context current before it goes away. */
+    void
+    release();
+
+    std::string name_;
+    int context_window_; //the window that owns the group's context, -1 if none.
+    int members_;
+
+  private:
+    explicit
+    ShareGroup(const std::string& name);
+
+    boost::mutex mtx_;
+    std::map<std::string, boost::shared_ptr<void> > resources_;
+  };
+
+  /** Running mean and extremes of a series of samples, for the stats windows print. */
+  struct Stat
+  {
+    Stat();
+    void
+    add(double sample);
+    double
+    mean() const;
+    size_t count;
+    double sum, min, max;
+  };
+
+  std::ostream&
+  operator<<(std::ostream& out, const Stat& stat);
+
+  /** Pixels read back from a window's framebuffer, packed 8 bit BGR with the top row first. */
+  struct ReadbackImage
+  {
+    int width, height;
+    std::vector<unsigned char> bgr;
+  };
+  typedef boost::shared_ptr<const ReadbackImage> ReadbackImageConstPtr;
+
+  /** An extra camera drawn into a rectangle of the window, given as fractions of its size from the bottom left. */
+  struct View
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    View(float x = 0, float y = 0, float width = 1, float height = 1);
+    float x, y, width, height;
+    Camera camera;
+  };
+  typedef std::vector<View, Eigen::aligned_allocator<View> > Views;
+
   class GLWindow
   {
   public:
-    GLWindow(const std::string& windowname);
+    GLWindow(const std::string& windowname, const std::string& share_group = std::string());
 
     virtual
     ~GLWindow();
 
     std::string windowname_;
     int id_;
+    ShareGroup::ptr share_group_;
 
     Camera camera_;
     Mouse mouse_;
 
+    /**
+     * Arrange the window as "single" (camera_ only), "split" (camera_ and a
+     * side view), "pip" (a top view inset over camera_) or "quad" (camera_
+     * plus front, top and side views). The extra views start from camera_
+     * turned towards view_center_ and rotated about it, and are applied at
+     * the next reshape.
+     */
+    void
+    setLayout(const std::string& layout);
+
+    /** camera_ followed by the cameras of the extra views, in drawing order. */
+    std::vector<Camera*>
+    cameras();
+
+    /** Set the viewport and scissor to the camera's rectangle and clear it. */
+    void
+    beginView(const Camera& camera);
+
+    std::string layout_;
+    float main_rect_[4]; //x, y, width, height of camera_ as window fractions.
+    Views views_;
+    Eigen::Vector3f view_center_; //the point the top and side views orbit around.
+
     virtual void
     display();
 
@@ -57,12 +166,154 @@ namespace ecto_gl
     virtual void
     destroy();
 
+    /** Called by the backend after display() when readback_ is set, with the framebuffer still bound. */
+    void
+    readback(int width, int height);
+
+    /** The last frame read back, or null if there is none yet. */
+    ReadbackImageConstPtr
+    lastFrame() const;
+
+    /** Read back every displayed frame. The headless backend always does. */
+    bool readback_;
+
+    /**
+     * False for windows that only compute, in timerfunc(), which runs with
+     * the window's context current whether it is shown or not. Glut hides
+     * them and the headless backend does not read them back.
+     */
+    bool visible_;
+
+    /**
+     * Called by the backend right after the frame was swapped. Fences the
+     * frame, blocks while more than max_frames_in_flight_ frames are queued
+     * on the GPU, and measures latency for frames that showed new data.
+     */
+    void
+    presented();
+
+    /** Subclasses call this from display() when the frame shows data that arrived at the given time. */
+    void
+    frameShowsData(const boost::posix_time::ptime& arrival);
+
+    /** Swap interval requested from the driver when the window is created, -1 keeps the driver default. */
+    int swap_interval_;
+    /** Frames allowed on the GPU at once, counting the one about to be drawn; 0 for no limit. */
+    int max_frames_in_flight_;
+    /** Milliseconds from data arrival until the GPU finished the first frame showing it. */
+    Stat latency_ms_;
+
+    /** Swap without vsync and keep a single frame in flight, for the least data to photon time. */
+    void
+    setLowLatency();
+
     typedef boost::shared_ptr<GLWindow> ptr;
     typedef boost::shared_ptr<const GLWindow> const_ptr;
+
+  private:
+    void
+    applyLayout();
+
+    Camera&
+    activeCamera();
+
+    int width_, height_;
+    int active_view_; //the view mouse drags apply to, -1 for camera_.
+    bool layout_dirty_;
+
+    struct InFlight
+    {
+      GLsync fence;
+      boost::posix_time::ptime arrival;
+    };
+
+    void
+    retire(bool wait);
+
+    mutable boost::mutex frame_mtx_;
+    ReadbackImageConstPtr frame_;
+    std::deque<InFlight> in_flight_;
+    boost::posix_time::ptime frame_arrival_;
+  };
+
+  /**
+   * Keeps a camera responsive on clouds too big to draw every frame. While the
+   * view changes, only budget_ points are drawn; once it rests, the remaining
+   * points are added budget_ at a time into an offscreen buffer that keeps the
+   * picture built so far, until the whole cloud is shown. Drawers pass a
+   * callback that draws the points in [begin, end) of their cloud, as
+   * fractions, and are expected to order points so that any range is a random
+   * sample of the whole. With target_fps_ set, the budget follows the measured
+   * GPU time to hold that rate.
+   */
+  class ProgressiveDraw: boost::noncopyable
+  {
+  public:
+    typedef boost::function<void
+    (double begin, double end)> DrawRange;
+
+    ProgressiveDraw(size_t budget = 0, float target_fps = 0);
+
+    ~ProgressiveDraw();
+
+    /**
+     * Draw one frame of a cloud of n points through the camera, starting over
+     * when changed is set or the camera moved. Returns true while points are
+     * still missing from the picture. A zero budget draws everything at once.
+     */
+    bool
+    draw(const Camera& camera, size_t n, bool changed, const DrawRange& draw_range);
+
+    /** Delete the GL objects, with the context current. */
+    void
+    release();
+
+    size_t budget_;
+    float target_fps_;
+    double done_; //fraction of the cloud in the picture.
+    Stat draw_ms_;
+
+  private:
+    void
+    adaptBudget();
+
+    GLuint fbo_, color_, depth_;
+    int width_, height_;
+    Eigen::Matrix<float, 4, 4, Eigen::DontAlign> last_view_; //projection times view of the last frame
+    GLuint query_;
+    bool query_pending_;
+    size_t query_points_;
+  };
+
+  /**
+   * A GL context that shares objects with the context current at creation,
+   * for use by worker threads that upload or compute while windows render.
+   */
+  class SharedContext: boost::noncopyable
+  {
+  public:
+    typedef boost::shared_ptr<SharedContext> ptr;
+
+    /** Create a context sharing with the calling thread's current context. */
+    static ptr
+    create();
+
+    virtual
+    ~SharedContext();
+
+    virtual void
+    makeCurrent() = 0;
+
+    virtual void
+    doneCurrent() = 0;
   };
 
   void
   show_window(GLWindow::ptr window);
+
+  /** Draw and swap window synchronously on the calling thread, creating it on first use. */
+  void
+  render_inline(GLWindow::ptr window);
   void
   destroy_window(const GLWindow& window);
 
@@ -76,9 +327,15 @@ namespace ecto_gl
 
   struct GlProgram
   {
-    GlProgram(const char* pVertexSource, const char* pFragmentSource);
+    /**
+     * Compile and link; the varyings named in feedback are captured interleaved
+     * by transform feedback. A geometry shader is optional.
+     */
+    GlProgram(const char* pVertexSource, const char* pFragmentSource,
+              const std::vector<std::string>& feedback = std::vector<std::string>(),
+              const char* pGeometrySource = 0);
     ~GlProgram();
-    GLuint vertexShader, fragmentShader;
+    GLuint vertexShader, fragmentShader, geometryShader;
     GLuint program;
   };
 
@@ -17,10 +17,12 @@
 
 #include <GL/glew.h>
 
-#include "ecto_gl.hpp"
+#include "backend.hpp"
 
 //#include <GL/glut.h>
 #include <GL/freeglut.h>
+#include <GL/glxew.h>
+#include <X11/Xlib.h>
 
 #define SHOW_ME() {static unsigned count; std::cout << __PRETTY_FUNCTION__ << ":" << count++ << std::endl;}
 
@@ -28,20 +30,81 @@ namespace ecto_gl
 {
   namespace mi = boost::multi_index;
 
-  class GlutContext: boost::noncopyable
+  /**
+   * A GLX context on a 1x1 pbuffer, sharing objects with the glut window
+   * context it was created from.
+   */
+  class GlxSharedContext: public SharedContext
+  {
+  public:
+    GlxSharedContext()
+        :
+          display_(glXGetCurrentDisplay()),
+          pbuffer_(None),
+          context_(0)
+    {
+      GLXContext share = glXGetCurrentContext();
+      if (!display_ || !share)
+        throw std::logic_error("A shared context needs a current GLX context.");
+      int config_attribs[] =
+      { GLX_DRAWABLE_TYPE, GLX_PBUFFER_BIT, GLX_RENDER_TYPE, GLX_RGBA_BIT, None };
+      int n = 0;
+      GLXFBConfig* configs = glXChooseFBConfig(display_, DefaultScreen(display_), config_attribs, &n);
+      if (!configs || n == 0)
+        throw std::runtime_error("No GLX pbuffer config for a shared context.");
+      int pbuffer_attribs[] =
+      { GLX_PBUFFER_WIDTH, 1, GLX_PBUFFER_HEIGHT, 1, None };
+      pbuffer_ = glXCreatePbuffer(display_, configs[0], pbuffer_attribs);
+      context_ = glXCreateNewContext(display_, configs[0], GLX_RGBA_TYPE, share, True);
+      XFree(configs);
+      if (!context_)
+      {
+        glXDestroyPbuffer(display_, pbuffer_);
+        throw std::runtime_error("Could not create a shared GLX context.");
+      }
+    }
+
+    ~GlxSharedContext()
+    {
+      glXDestroyContext(display_, context_);
+      glXDestroyPbuffer(display_, pbuffer_);
+    }
+
+    void
+    makeCurrent()
+    {
+      glXMakeContextCurrent(display_, pbuffer_, pbuffer_, context_);
+    }
+
+    void
+    doneCurrent()
+    {
+      glXMakeContextCurrent(display_, None, None, 0);
+    }
+
+  private:
+    Display* display_;
+    GLXPbuffer pbuffer_;
+    GLXContext context_;
+  };
+
+
+  class GlutContext: public Backend
   {
     struct GLWindowH
     {
       GLWindowH()
           :
-            id(-1)
+            id(-1),
+            drawable(None)
       {
       }
 
       explicit
       GLWindowH(int id)
           :
-            id(id)
+            id(id),
+            drawable(None)
       {
       }
       explicit
@@ -49,7 +112,8 @@ namespace ecto_gl
           :
             window(w),
             id(w->id_),
-            name(w->windowname_)
+            name(w->windowname_),
+            drawable(None)
       {
       }
 
@@ -62,6 +126,7 @@ namespace ecto_gl
       GLWindow::ptr window;
       int id;
       std::string name;
+      GLXDrawable drawable;
 
       friend std::ostream&
       operator<<(std::ostream& out, GLWindowH& gh)
@@ -82,10 +147,11 @@ namespace ecto_gl
     GlutContext()
         :
           frame_time_(30),
+          display_(0),
           started_(false),
-          quit_(false)
+          quit_(false),
+          inline_(false)
     {
-      start();
     }
 
   public:
@@ -98,13 +164,51 @@ namespace ecto_gl
     void
     post_window(boost::shared_ptr<GLWindow> gw)
     {
+      if (inline_)
+        throw std::logic_error("Windows can not be shown on the glut thread once inline rendering is in use.");
       start();
       boost::mutex::scoped_lock lock(adds_mtx_);
       windowadds_.connect(0, boost::bind(&GlutContext::add_window, this, gw));
     }
+    /**
+     * Draw and swap a window on the calling thread instead of the glut
+     * thread, creating it on first use. Inline windows are serialized with
+     * each other and can not be mixed with windows on the glut thread.
+     */
+    void
+    render_inline(boost::shared_ptr<GLWindow> gw)
+    {
+      boost::mutex::scoped_lock lock(inline_mtx_);
+      if (mlthread_.joinable())
+        throw std::logic_error("Inline rendering can not be mixed with windows shown on the glut thread.");
+      inline_ = true;
+      init();
+      if (!windows_.get<2>().count(gw))
+        add_window(gw);
+      glutMainLoopEvent();
+      WindowSet::iterator it = windows_.find(GLWindowH(gw->id_));
+      if (gw->id_ < 0 || it == windows_.end())
+        return;
+      //glutSetWindow does nothing if gw is still glut's current window, bind explicitly.
+      glutSetWindow(gw->id_);
+      makeCurrent(*it);
+      //inline windows have no glut timer.
+      gw->timerfunc(gw->id_);
+      display();
+      //let the next inline call make the context current on whichever thread it runs.
+      glXMakeContextCurrent(display_, None, None, 0);
+    }
+
     void
     post_remove_window(boost::shared_ptr<GLWindow> gw)
     {
+      if (inline_)
+      {
+        boost::mutex::scoped_lock lock(inline_mtx_);
+        if (windows_.get<2>().count(gw))
+          destroyWindow(GLWindowH(gw));
+        return;
+      }
       boost::mutex::scoped_lock lock(adds_mtx_);
       windowadds_.connect(0, boost::bind(&GlutContext::destroyWindow, this, GLWindowH(gw)));
     }
@@ -118,7 +222,8 @@ namespace ecto_gl
     void
     wait()
     {
-      mlthread_.join();
+      if (mlthread_.joinable())
+        mlthread_.join();
     }
 
     void
@@ -128,6 +233,12 @@ namespace ecto_gl
       wait();
     }
 
+    SharedContext::ptr
+    create_shared_context()
+    {
+      return SharedContext::ptr(new GlxSharedContext);
+    }
+
     void
     start()
     {
@@ -171,36 +282,128 @@ namespace ecto_gl
         return;
       }
       int win = glutCreateWindow(&*(gw->windowname_.begin()));
+      if (!display_)
+        display_ = glXGetCurrentDisplay();
+      ShareGroup& group = *gw->share_group_;
+      GLXContext& context = contexts_[&group];
+      if (!context)
+        context = createGroupContext();
+      ++group.members_;
       gw->id_ = win;
       GLWindowH gh(gw);
+      gh.drawable = glXGetCurrentDrawable();
       windows_.insert(gh);
+      makeCurrent(gh);
       glutDisplayFunc(&GlutContext::display);
       glutMouseFunc(&GlutContext::mouse);
       glutReshapeFunc(&GlutContext::reshape);
       glutMotionFunc(&GlutContext::motion);
-      glutTimerFunc(frame_time_, &GlutContext::timer, gw->id_);
+      if (!inline_)
+        glutTimerFunc(frame_time_, &GlutContext::timer, gw->id_);
       glutKeyboardFunc(&GlutContext::keyboard);
       gw->init();
+      setSwapInterval(*gw);
+      if (!gw->visible_)
+        glutHideWindow();
+    }
+
+    void
+    setSwapInterval(const GLWindow& gw)
+    {
+      if (gw.swap_interval_ < 0)
+        return;
+      if (GLXEW_EXT_swap_control)
+        glXSwapIntervalEXT(glXGetCurrentDisplay(), glXGetCurrentDrawable(), gw.swap_interval_);
+      else if (GLXEW_SGI_swap_control && gw.swap_interval_ > 0)
+        glXSwapIntervalSGI(gw.swap_interval_);
+      else
+        std::cerr << "Can not set swap interval " << gw.swap_interval_ << " for " << gw.windowname_ << std::endl;
+    }
+
+    /**
+     * A context for a share group, on the fbconfig of the window just
+     * created. glut destroys a window's context when it closes the window,
+     * even one it was asked to reuse, so the windows of a group render with
+     * a context of ours and glut only ever destroys its own.
+     */
+    GLXContext
+    createGroupContext()
+    {
+      int config_id = 0, screen = 0;
+      glXQueryContext(display_, glXGetCurrentContext(), GLX_FBCONFIG_ID, &config_id);
+      glXQueryContext(display_, glXGetCurrentContext(), GLX_SCREEN, &screen);
+      int config_attribs[] =
+      { GLX_FBCONFIG_ID, config_id, None };
+      int n = 0;
+      GLXFBConfig* configs = glXChooseFBConfig(display_, screen, config_attribs, &n);
+      if (!configs || n == 0)
+        throw std::runtime_error("No GLX config for a share group context.");
+      GLXContext context = glXCreateNewContext(display_, configs[0], GLX_RGBA_TYPE, 0, True);
+      XFree(configs);
+      if (!context)
+        throw std::runtime_error("Could not create a share group context.");
+      return context;
+    }
+
+    /**
+     * Bind a window's drawable to its group's context. glutSetWindow, and
+     * glut before each callback, bind the window's own context instead.
+     */
+    void
+    makeCurrent(const GLWindowH& gh)
+    {
+      GLXContext context = contexts_[gh.window->share_group_.get()];
+      if (glXGetCurrentContext() != context || glXGetCurrentDrawable() != gh.drawable)
+        glXMakeContextCurrent(display_, gh.drawable, gh.drawable, context);
+    }
+
+    /**
+     * The window of the current glut callback, with its group's context bound.
+     */
+    static GLWindow::ptr
+    currentWindow()
+    {
+      GlutContext& self = instance();
+      WindowSet::iterator it = self.windows_.find(GLWindowH(glutGetWindow()));
+      if (it == self.windows_.end() || !it->window)
+        return GLWindow::ptr();
+      self.makeCurrent(*it);
+      return it->window;
     }
 
     void
     destroyWindow(GLWindowH win)
     {
       int previous_window = glutGetWindow();
-      GLWindow::ptr w = getWindow(win.id);
+      WindowSet::iterator it = windows_.find(win);
+      GLWindow::ptr w = it != windows_.end() ? it->window : GLWindow::ptr();
       glutSetWindow(win.id);
       if (w)
+      {
+        makeCurrent(*it);
         w->destroy();
+        ShareGroup& group = *w->share_group_;
+        if (--group.members_ == 0)
+        {
+          group.release();
+          glXMakeContextCurrent(display_, None, None, 0);
+          glXDestroyContext(display_, contexts_[&group]);
+          contexts_.erase(&group);
+        }
+      }
       windows_.erase(win);
       glutDestroyWindow(win.id);
-      glutSetWindow(previous_window);
+      if (previous_window != win.id)
+        glutSetWindow(previous_window);
     }
 
     void
-    mainloop()
+    init()
     {
       if (!started_)
       {
+        //shared contexts make GLX calls on the glut display from other threads.
+        XInitThreads();
         int argc = 1;
         const char * argv[] =
         { "./ecto_glut", 0 };
@@ -209,6 +412,12 @@ namespace ecto_gl
         glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_CONTINUE_EXECUTION);
         started_ = true;
       }
+    }
+
+    void
+    mainloop()
+    {
+      init();
       quit_ = false;
       while (!boost::this_thread::interruption_requested() && !quit_)
       {
@@ -243,7 +452,7 @@ namespace ecto_gl
     display()
     {
       int window = glutGetWindow();
-      GLWindow::ptr w = getWindow(window);
+      GLWindow::ptr w = currentWindow();
 
       if (w && window != w->id_)
       {
@@ -252,15 +461,20 @@ namespace ecto_gl
         throw std::logic_error(s.str()); // not sure if this will ever happen.
       }
       if (w)
+      {
         w->display();
+        if (w->readback_)
+          w->readback(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+      }
       glutSwapBuffers();
+      if (w)
+        w->presented();
     }
 
     static void
     motion(int x, int y)
     {
-      int window = glutGetWindow();
-      GLWindow::ptr w = getWindow(window);
+      GLWindow::ptr w = currentWindow();
       if (w)
         w->motion(x, y);
     }
@@ -268,8 +482,7 @@ namespace ecto_gl
     static void
     reshape(int width, int height)
     {
-      int window = glutGetWindow();
-      GLWindow::ptr w = getWindow(window);
+      GLWindow::ptr w = currentWindow();
       if (w)
         w->reshape(width, height);
     }
@@ -296,7 +509,7 @@ namespace ecto_gl
         instance().windows_.erase(GLWindowH(val));
         return;
       }
-      GLWindow::ptr w = getWindow(val);
+      GLWindow::ptr w = currentWindow();
       if (w)
         w->timerfunc(val);
       glutPostRedisplay();
@@ -306,8 +519,7 @@ namespace ecto_gl
     static void
     mouse(int button, int state, int x, int y)
     {
-      int window = glutGetWindow();
-      GLWindow::ptr w = getWindow(window);
+      GLWindow::ptr w = currentWindow();
       Mouse m(x, y, state, button, glutGetModifiers());
       if (w)
         w->mouse(m);
@@ -315,48 +527,25 @@ namespace ecto_gl
 
     static boost::shared_ptr<GlutContext> instance_;
     static boost::mutex mtx_;
-    boost::mutex adds_mtx_;
+    boost::mutex adds_mtx_, inline_mtx_;
     boost::thread mlthread_;
     boost::signals2::signal<void
     (void)> windowadds_;
     WindowSet windows_;
+    std::map<ShareGroup*, GLXContext> contexts_;
     int frame_time_;
-    bool started_, quit_;
+    Display* display_;
+    bool started_, quit_, inline_;
   }
   ;
 
   boost::shared_ptr<GlutContext> GlutContext::instance_;
   boost::mutex GlutContext::mtx_;
 
-  void
-  show_window(GLWindow::ptr window)
-  {
-    GlutContext::instance().post_window(window);
-  }
-
-  void
-  destroy_window(GLWindow::ptr window)
+  Backend&
+  glut_backend()
   {
-    GlutContext::instance().post_remove_window(window);
-  }
-
-  void
-  destroy_window(const GLWindow& window)
-  {
-    GlutContext::instance().post_remove_window(window);
-  }
-
-  void
-  wait()
-  {
-    GlutContext::instance().wait();
-  }
-
-  void
-  stop()
-  {
-    GlutContext::instance().stop();
-
+    return GlutContext::instance();
   }
 
   int
@@ -0,0 +1,359 @@
+#include <map>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <boost/signals2.hpp>
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "backend.hpp"
+
+namespace ecto_gl
+{
+  namespace
+  {
+    /** Prefer Mesa's surfaceless platform, which needs neither X nor a GPU, e.g. on llvmpipe. */
+    EGLDisplay
+    open_display()
+    {
+      EGLDisplay display = EGL_NO_DISPLAY;
+      const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+      if (client_extensions && std::string(client_extensions).find("EGL_MESA_platform_surfaceless") != std::string::npos)
+      {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+          display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+      }
+      if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+      EGLint major = 0, minor = 0;
+      if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+        throw std::runtime_error("Could not initialize an EGL display for headless rendering.");
+      return display;
+    }
+  }
+
+  /**
+   * A context that renders without a surface when EGL_KHR_surfaceless_context
+   * is available, and on a private 1x1 pbuffer otherwise.
+   */
+  class EglContext: public SharedContext
+  {
+  public:
+    EglContext(EGLDisplay display, EGLConfig config, EGLContext share)
+        :
+          display_(display),
+          surface_(EGL_NO_SURFACE),
+          context_(EGL_NO_CONTEXT)
+    {
+      eglBindAPI(EGL_OPENGL_API);
+      context_ = eglCreateContext(display_, config, share, NULL);
+      if (context_ == EGL_NO_CONTEXT)
+        throw std::runtime_error("Could not create an EGL context.");
+      std::string extensions = eglQueryString(display_, EGL_EXTENSIONS);
+      if (extensions.find("EGL_KHR_surfaceless_context") == std::string::npos)
+      {
+        EGLint attribs[] =
+        { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        surface_ = eglCreatePbufferSurface(display_, config, attribs);
+      }
+    }
+
+    ~EglContext()
+    {
+      if (eglGetCurrentContext() == context_)
+        doneCurrent();
+      eglDestroyContext(display_, context_);
+      if (surface_ != EGL_NO_SURFACE)
+        eglDestroySurface(display_, surface_);
+    }
+
+    void
+    makeCurrent()
+    {
+      eglMakeCurrent(display_, surface_, surface_, context_);
+    }
+
+    void
+    doneCurrent()
+    {
+      eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+
+    EGLContext
+    context() const
+    {
+      return context_;
+    }
+
+  private:
+    EGLDisplay display_;
+    EGLSurface surface_;
+    EGLContext context_;
+  };
+
+  /**
+   * Renders windows into framebuffer objects of EGL contexts, with no window
+   * system at all. Every displayed frame is read back, so cells get their
+   * output through GLWindow::lastFrame(). Windows of a share group render
+   * with one context, as they do with glut.
+   */
+  class HeadlessContext: public Backend
+  {
+    struct Surface
+    {
+      GLWindow::ptr window;
+      boost::shared_ptr<EglContext> context;
+      GLuint fbo, color, depth;
+    };
+    typedef std::map<int, Surface> Surfaces;
+
+    HeadlessContext()
+        :
+          display_(EGL_NO_DISPLAY),
+          config_(0),
+          width_(640),
+          height_(480),
+          frame_time_(30),
+          next_id_(1),
+          inline_(false)
+    {
+    }
+
+  public:
+    ~HeadlessContext()
+    {
+      mlthread_.interrupt();
+      if (mlthread_.joinable())
+        mlthread_.join();
+    }
+
+    static HeadlessContext&
+    instance()
+    {
+      static boost::mutex mtx;
+      static boost::shared_ptr<HeadlessContext> instance;
+      boost::mutex::scoped_lock lock(mtx);
+      if (!instance)
+        instance.reset(new HeadlessContext());
+      return *instance;
+    }
+
+    void
+    post_window(GLWindow::ptr gw)
+    {
+      if (inline_)
+        throw std::logic_error("Windows can not be shown on the render thread once inline rendering is in use.");
+      if (!mlthread_.joinable())
+        mlthread_ = boost::thread(boost::bind(&HeadlessContext::mainloop, this));
+      boost::mutex::scoped_lock lock(adds_mtx_);
+      windowadds_.connect(0, boost::bind(&HeadlessContext::add_window, this, gw));
+    }
+
+    void
+    post_remove_window(GLWindow::ptr gw)
+    {
+      post_remove_window(*gw);
+    }
+
+    void
+    post_remove_window(const GLWindow& gw)
+    {
+      if (inline_)
+      {
+        boost::mutex::scoped_lock lock(inline_mtx_);
+        destroy_window(gw.id_);
+        return;
+      }
+      boost::mutex::scoped_lock lock(adds_mtx_);
+      windowadds_.connect(0, boost::bind(&HeadlessContext::destroy_window, this, gw.id_));
+    }
+
+    void
+    render_inline(GLWindow::ptr gw)
+    {
+      boost::mutex::scoped_lock lock(inline_mtx_);
+      if (mlthread_.joinable())
+        throw std::logic_error("Inline rendering can not be mixed with windows shown on the render thread.");
+      inline_ = true;
+      add_window(gw);
+      Surfaces::iterator it = surfaces_.find(gw->id_);
+      if (it == surfaces_.end())
+        return;
+      render(it->second);
+      it->second.context->doneCurrent();
+    }
+
+    void
+    wait()
+    {
+      if (mlthread_.joinable())
+        mlthread_.join();
+    }
+
+    void
+    stop()
+    {
+      mlthread_.interrupt();
+      wait();
+    }
+
+    SharedContext::ptr
+    create_shared_context()
+    {
+      init();
+      return SharedContext::ptr(new EglContext(display_, config_, eglGetCurrentContext()));
+    }
+
+  private:
+    void
+    init()
+    {
+      boost::mutex::scoped_lock lock(init_mtx_);
+      if (display_ != EGL_NO_DISPLAY)
+        return;
+      display_ = open_display();
+      EGLint attribs[] =
+      { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8, EGL_NONE };
+      EGLint n = 0;
+      if (!eglChooseConfig(display_, attribs, &config_, 1, &n) || n == 0)
+        throw std::runtime_error("No EGL config with desktop OpenGL support.");
+    }
+
+    void
+    add_window(GLWindow::ptr gw)
+    {
+      if (surfaces_.count(gw->id_) && surfaces_[gw->id_].window == gw)
+        return;
+      init();
+      ShareGroup& group = *gw->share_group_;
+      Surface s;
+      s.window = gw;
+      Surfaces::iterator owner = surfaces_.find(group.context_window_);
+      if (owner != surfaces_.end())
+        s.context = owner->second.context;
+      else
+        s.context.reset(new EglContext(display_, config_, EGL_NO_CONTEXT));
+      s.context->makeCurrent();
+      glewInit();
+      glGenFramebuffers(1, &s.fbo);
+      glGenRenderbuffers(1, &s.color);
+      glGenRenderbuffers(1, &s.depth);
+      glBindRenderbuffer(GL_RENDERBUFFER, s.color);
+      glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width_, height_);
+      glBindRenderbuffer(GL_RENDERBUFFER, s.depth);
+      glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width_, height_);
+      glBindRenderbuffer(GL_RENDERBUFFER, 0);
+      glBindFramebuffer(GL_FRAMEBUFFER, s.fbo);
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, s.color);
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, s.depth);
+      if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Incomplete framebuffer for headless window " << gw->windowname_ << std::endl;
+
+      gw->id_ = next_id_++;
+      if (owner == surfaces_.end())
+        group.context_window_ = gw->id_;
+      ++group.members_;
+      gw->readback_ = true;
+      surfaces_[gw->id_] = s;
+      gw->init();
+      gw->reshape(width_, height_);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void
+    destroy_window(int id)
+    {
+      Surfaces::iterator it = surfaces_.find(id);
+      if (it == surfaces_.end())
+        return;
+      Surface s = it->second;
+      surfaces_.erase(it);
+      s.context->makeCurrent();
+      s.window->destroy();
+      ShareGroup& group = *s.window->share_group_;
+      if (--group.members_ == 0)
+      {
+        group.release();
+        group.context_window_ = -1;
+      }
+      else if (group.context_window_ == id)
+      {
+        for (Surfaces::iterator other = surfaces_.begin(); other != surfaces_.end(); ++other)
+          if (other->second.context == s.context)
+            group.context_window_ = other->first;
+      }
+      glDeleteFramebuffers(1, &s.fbo);
+      glDeleteRenderbuffers(1, &s.color);
+      glDeleteRenderbuffers(1, &s.depth);
+      s.context->doneCurrent();
+    }
+
+    void
+    render(Surface& s)
+    {
+      s.context->makeCurrent();
+      glBindFramebuffer(GL_FRAMEBUFFER, s.fbo);
+      s.window->timerfunc(s.window->id_);
+      s.window->display();
+      if (s.window->visible_)
+      {
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        s.window->readback(width_, height_);
+      }
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      //there is no swap, but the frame pacing and latency measurement still apply.
+      glFlush();
+      s.window->presented();
+    }
+
+    void
+    mainloop()
+    {
+      try
+      {
+        while (!boost::this_thread::interruption_requested())
+        {
+          {
+            boost::mutex::scoped_lock lock(adds_mtx_);
+            windowadds_();
+            windowadds_.disconnect(0);
+          }
+          for (Surfaces::iterator it = surfaces_.begin(); it != surfaces_.end(); ++it)
+            render(it->second);
+          boost::this_thread::sleep(boost::posix_time::milliseconds(frame_time_));
+        }
+      } catch (const boost::thread_interrupted&)
+      {
+      }
+      while (!surfaces_.empty())
+        destroy_window(surfaces_.begin()->first);
+    }
+
+    EGLDisplay display_;
+    EGLConfig config_;
+    int width_, height_;
+    int frame_time_;
+    int next_id_;
+    bool inline_;
+    Surfaces surfaces_;
+    boost::mutex adds_mtx_, inline_mtx_, init_mtx_;
+    boost::thread mlthread_;
+    boost::signals2::signal<void
+    (void)> windowadds_;
+  };
+
+  Backend&
+  headless_backend()
+  {
+    return HeadlessContext::instance();
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <boost/cstdint.hpp>
+
+namespace ecto_gl
+{
+  /**
+   * On-disk layout of a level-of-detail point octree, as written by
+   * ecto_gl_octree_build and memory mapped by OctreeDisplay:
+   *
+   *   OctreeHeader, OctreePoint[n_points], OctreeNode[n_nodes]
+   *
+   * Every node holds a grid subsample of the points in its cube, spaced about
+   * spacing apart; the points not kept pass down to its children. Drawing a
+   * node and all its ancestors therefore shows its cube at the node's density,
+   * and a viewer refines by loading children where the screen needs more.
+   * Node 0 is the root, and parents come before their children.
+   */
+  static const char OCTREE_MAGIC[8] =
+  { 'E', 'C', 'T', 'O', 'O', 'C', 'T', '1' };
+
+  struct OctreeHeader
+  {
+    char magic[8];
+    uint32_t n_nodes;
+    uint32_t reserved;
+    uint64_t n_points;
+  };
+
+  struct OctreeNode
+  {
+    float min[3]; //corner of the node's cube
+    float size; //edge of the cube
+    float spacing; //minimum distance between the node's own points
+    uint32_t count; //points of this node
+    uint64_t first; //index of the node's first point
+    int32_t children[8]; //-1 for none, child i covers the octant with x, y, z bits of i
+  };
+
+  struct OctreePoint
+  {
+    float x, y, z;
+    uint8_t r, g, b, a;
+  };
+}
@@ -0,0 +1,357 @@
+/*
+ * Builds the level-of-detail octree file that OctreeDisplay views, from a
+ * binary little endian PLY with float or double x, y, z and optional uchar
+ * red, green, blue vertex properties:
+ *
+ *   ecto_gl_octree_build scan.ply scan.octree [max_leaf_points]
+ *
+ * The input is memory mapped and only an index per point is held in memory,
+ * so clouds of hundreds of millions of points build on an ordinary machine.
+ */
+#include "octree.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/unordered_set.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ecto_gl;
+
+namespace
+{
+  /** Cells per node edge of the grid that picks a node's own points. */
+  const int GRID = 128;
+  const int MAX_DEPTH = 20;
+
+  struct Property
+  {
+    std::string name;
+    int offset, size;
+    bool is_double;
+  };
+
+  /** The vertex records of a mapped PLY file. */
+  struct PlyVertices
+  {
+    PlyVertices(const char* path)
+        :
+          data(0),
+          bytes(0)
+    {
+      int fd = open(path, O_RDONLY);
+      if (fd < 0)
+        throw std::runtime_error(std::string("Can not open ") + path);
+      struct stat st;
+      fstat(fd, &st);
+      bytes = st.st_size;
+      data = (const char*) mmap(0, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (data == MAP_FAILED)
+        throw std::runtime_error(std::string("Can not map ") + path);
+      madvise((void*) data, bytes, MADV_SEQUENTIAL);
+      parseHeader();
+    }
+
+    ~PlyVertices()
+    {
+      munmap((void*) data, bytes);
+    }
+
+    void
+    parseHeader()
+    {
+      const char* end = (const char*) memmem(data, std::min<size_t>(bytes, 65536), "end_header\n", 11);
+      if (std::strncmp(data, "ply", 3) || !end)
+        throw std::runtime_error("Not a PLY file.");
+      std::istringstream header(std::string(data, end));
+      records = data + (end - data) + 11;
+      std::string line;
+      bool in_vertex = false, seen_vertex = false;
+      stride = 0;
+      count = 0;
+      while (std::getline(header, line))
+      {
+        std::istringstream words(line);
+        std::string word;
+        words >> word;
+        if (word == "format")
+        {
+          words >> word;
+          if (word != "binary_little_endian")
+            throw std::runtime_error("Only binary_little_endian PLY files are supported.");
+        }
+        else if (word == "element")
+        {
+          std::string name;
+          words >> name;
+          if (seen_vertex && name != "vertex")
+            in_vertex = false;
+          else if (name == "vertex")
+          {
+            words >> count;
+            in_vertex = seen_vertex = true;
+          }
+          else
+            throw std::runtime_error("The vertex element has to come first.");
+        }
+        else if (word == "property" && in_vertex)
+        {
+          std::string type;
+          Property p;
+          words >> type >> p.name;
+          if (type == "list")
+            throw std::runtime_error("List properties of vertices are not supported.");
+          p.size = type == "double" || type == "float64" ? 8 :
+                   type == "float" || type == "float32" || type == "int" || type == "uint" || type == "int32"
+                   || type == "uint32" ? 4 :
+                   type == "short" || type == "ushort" || type == "int16" || type == "uint16" ? 2 : 1;
+          p.is_double = p.size == 8;
+          p.offset = stride;
+          stride += p.size;
+          properties.push_back(p);
+        }
+      }
+      x = find("x"), y = find("y"), z = find("z");
+      r = find("red"), g = find("green"), b = find("blue");
+      if (!x || !y || !z)
+        throw std::runtime_error("The vertices have no x, y, z.");
+      if (records + stride * count > data + bytes)
+        throw std::runtime_error("The PLY file is truncated.");
+    }
+
+    const Property*
+    find(const std::string& name) const
+    {
+      for (size_t i = 0; i < properties.size(); i++)
+        if (properties[i].name == name)
+          return &properties[i];
+      return 0;
+    }
+
+    float
+    get(size_t i, const Property* p) const
+    {
+      const char* v = records + i * stride + p->offset;
+      if (p->is_double)
+      {
+        double d;
+        std::memcpy(&d, v, 8);
+        return d;
+      }
+      float f;
+      std::memcpy(&f, v, 4);
+      return f;
+    }
+
+    OctreePoint
+    point(size_t i) const
+    {
+      OctreePoint p;
+      p.x = get(i, x);
+      p.y = get(i, y);
+      p.z = get(i, z);
+      const char* v = records + i * stride;
+      p.r = r ? v[r->offset] : 255;
+      p.g = g ? v[g->offset] : 255;
+      p.b = b ? v[b->offset] : 255;
+      p.a = 255;
+      return p;
+    }
+
+    const char* data;
+    size_t bytes;
+    const char* records;
+    size_t stride, count;
+    std::vector<Property> properties;
+    const Property *x, *y, *z, *r, *g, *b;
+  };
+
+  class Builder
+  {
+  public:
+    Builder(const PlyVertices& ply, std::ofstream& out, size_t max_leaf)
+        :
+          ply(ply),
+          out(out),
+          max_leaf(max_leaf),
+          written(0)
+    {
+    }
+
+    void
+    build(std::vector<uint32_t>& index, const float min[3], float size)
+    {
+      build(index.begin(), index.end(), min, size, 0);
+    }
+
+    std::vector<OctreeNode> nodes;
+
+  private:
+    typedef std::vector<uint32_t>::iterator It;
+
+    int
+    build(It begin, It end, const float min[3], float size, int depth)
+    {
+      int id = nodes.size();
+      nodes.push_back(OctreeNode());
+      OctreeNode node;
+      std::copy(min, min + 3, node.min);
+      node.size = size;
+      node.spacing = size / GRID;
+      std::fill(node.children, node.children + 8, -1);
+
+      //keep the first point in every grid cell, everything for small nodes.
+      It kept = end;
+      if (size_t(end - begin) > max_leaf && depth < MAX_DEPTH)
+      {
+        boost::unordered_set<uint32_t> cells;
+        kept = begin;
+        for (It it = begin; it != end; ++it)
+        {
+          OctreePoint p = ply.point(*it);
+          uint32_t cx = cell(p.x, min[0], size), cy = cell(p.y, min[1], size), cz = cell(p.z, min[2], size);
+          if (cells.insert((cz * GRID + cy) * GRID + cx).second)
+            std::iter_swap(it, kept++);
+        }
+      }
+      node.first = written;
+      node.count = kept - begin;
+      for (It it = begin; it != kept; ++it)
+      {
+        OctreePoint p = ply.point(*it);
+        out.write((const char*) &p, sizeof(p));
+      }
+      written += node.count;
+      if (nodes.size() % 1000 == 0)
+        std::cout << "\r" << nodes.size() << " nodes, " << written << " points" << std::flush;
+
+      //the rest go to the octants, split on x, then y, then z.
+      float half = size / 2;
+      It parts[9];
+      parts[0] = kept;
+      parts[8] = end;
+      parts[4] = std::partition(parts[0], parts[8], Below(ply, 0, min[0] + half));
+      for (int i = 0; i < 8; i += 4)
+      {
+        parts[i + 2] = std::partition(parts[i], parts[i + 4], Below(ply, 1, min[1] + half));
+        for (int j = i; j < i + 4; j += 2)
+          parts[j + 1] = std::partition(parts[j], parts[j + 2], Below(ply, 2, min[2] + half));
+      }
+      for (int k = 0; k < 8; k++)
+      {
+        if (parts[k] == parts[k + 1])
+          continue;
+        //ranges are ordered x, y, z from the top bit, octants from the bottom.
+        int octant = (k >> 2 & 1) | (k & 2) | (k << 2 & 4);
+        float child_min[3] =
+        { min[0] + (octant & 1) * half, min[1] + (octant >> 1 & 1) * half, min[2] + (octant >> 2 & 1) * half };
+        node.children[octant] = build(parts[k], parts[k + 1], child_min, half, depth + 1);
+      }
+      nodes[id] = node;
+      return id;
+    }
+
+    static uint32_t
+    cell(float v, float min, float size)
+    {
+      return std::min(GRID - 1, std::max(0, int((v - min) / size * GRID)));
+    }
+
+    struct Below
+    {
+      Below(const PlyVertices& ply, int axis, float split)
+          :
+            ply(ply),
+            axis(axis),
+            split(split)
+      {
+      }
+      bool
+      operator()(uint32_t i) const
+      {
+        OctreePoint p = ply.point(i);
+        return (axis == 0 ? p.x : axis == 1 ? p.y : p.z) < split;
+      }
+      const PlyVertices& ply;
+      int axis;
+      float split;
+    };
+
+    const PlyVertices& ply;
+    std::ofstream& out;
+    size_t max_leaf;
+    uint64_t written;
+  };
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    std::cerr << "usage: " << argv[0] << " input.ply output.octree [max_leaf_points=20000]" << std::endl;
+    return 1;
+  }
+  try
+  {
+    PlyVertices ply(argv[1]);
+    size_t max_leaf = argc > 3 ? std::atoi(argv[3]) : 20000;
+    std::cout << argv[1] << ": " << ply.count << " points" << std::endl;
+
+    float lo[3] =
+    { 1e30f, 1e30f, 1e30f }, hi[3] =
+    { -1e30f, -1e30f, -1e30f };
+    std::vector<uint32_t> index(ply.count);
+    for (size_t i = 0; i < ply.count; i++)
+    {
+      index[i] = i;
+      OctreePoint p = ply.point(i);
+      float v[3] =
+      { p.x, p.y, p.z };
+      for (int a = 0; a < 3; a++)
+      {
+        lo[a] = std::min(lo[a], v[a]);
+        hi[a] = std::max(hi[a], v[a]);
+      }
+    }
+    float size = 0;
+    for (int a = 0; a < 3; a++)
+      size = std::max(size, hi[a] - lo[a]);
+    size = size * 1.001f + 1e-6f;
+
+    std::ofstream out(argv[2], std::ios::binary);
+    OctreeHeader header;
+    std::memcpy(header.magic, OCTREE_MAGIC, 8);
+    header.reserved = 0;
+    out.write((const char*) &header, sizeof(header));
+    Builder builder(ply, out, max_leaf);
+    builder.build(index, lo, size);
+    out.write((const char*) builder.nodes.data(), builder.nodes.size() * sizeof(OctreeNode));
+    header.n_nodes = builder.nodes.size();
+    header.n_points = ply.count;
+    out.seekp(0);
+    out.write((const char*) &header, sizeof(header));
+    if (!out)
+      throw std::runtime_error(std::string("Could not write ") + argv[2]);
+    std::cout << "\r" << header.n_nodes << " nodes, " << header.n_points << " points written to " << argv[2]
+              << std::endl;
+  } catch (const std::exception& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <iostream>
+#include <GL/glew.h>
+
+#include "ecto_gl.hpp"
+
+namespace ecto_gl
+{
+  ProgressiveDraw::ProgressiveDraw(size_t budget, float target_fps)
+      :
+        budget_(budget),
+        target_fps_(target_fps),
+        done_(0),
+        fbo_(0),
+        color_(0),
+        depth_(0),
+        width_(0),
+        height_(0),
+        last_view_(Eigen::Matrix4f::Zero()),
+        query_(0),
+        query_pending_(false),
+        query_points_(0)
+  {
+  }
+
+  ProgressiveDraw::~ProgressiveDraw()
+  {
+  }
+
+  void
+  ProgressiveDraw::release()
+  {
+    //may run before glewInit, when there is nothing to free.
+    if (fbo_)
+    {
+      glDeleteFramebuffers(1, &fbo_);
+      glDeleteRenderbuffers(1, &color_);
+      glDeleteRenderbuffers(1, &depth_);
+    }
+    if (query_)
+      glDeleteQueries(1, &query_);
+    fbo_ = color_ = depth_ = query_ = 0;
+    width_ = height_ = 0;
+    query_pending_ = false;
+    done_ = 0;
+  }
+
+  void
+  ProgressiveDraw::adaptBudget()
+  {
+    if (!query_pending_)
+      return;
+    GLint available = 0;
+    glGetQueryObjectiv(query_, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      return;
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(query_, GL_QUERY_RESULT, &ns);
+    query_pending_ = false;
+    double ms = ns / 1e6;
+    draw_ms_.add(ms);
+    if (target_fps_ <= 0 || ms <= 0 || query_points_ < budget_ / 2)
+      return;
+    //aim at 80% of the frame time, and move there gradually.
+    double wanted = query_points_ * (800. / target_fps_) / ms;
+    budget_ = std::max<size_t>(10000, .7 * budget_ + .3 * wanted);
+  }
+
+  bool
+  ProgressiveDraw::draw(const Camera& c, size_t n, bool changed, const DrawRange& draw_range)
+  {
+    if (!budget_ || n <= budget_)
+    {
+      draw_range(0, 1);
+      done_ = 1;
+      return false;
+    }
+    if (!query_ && GLEW_ARB_timer_query)
+      glGenQueries(1, &query_);
+    adaptBudget();
+
+    Eigen::Matrix4f view = c.projectionMatrix() * c.viewMatrix().matrix();
+    if (changed || view != last_view_)
+      done_ = 0;
+    last_view_ = view;
+
+    //the picture covers the camera's viewport in window coordinates.
+    int width = c.vpX() + c.vpWidth(), height = c.vpY() + c.vpHeight();
+    if (!fbo_ || width != width_ || height != height_)
+    {
+      if (!fbo_)
+      {
+        glGenFramebuffers(1, &fbo_);
+        glGenRenderbuffers(1, &color_);
+        glGenRenderbuffers(1, &depth_);
+      }
+      width_ = width;
+      height_ = height;
+      glBindRenderbuffer(GL_RENDERBUFFER, color_);
+      glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width_, height_);
+      glBindRenderbuffer(GL_RENDERBUFFER, depth_);
+      glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width_, height_);
+      glBindRenderbuffer(GL_RENDERBUFFER, 0);
+      done_ = 0;
+    }
+
+    //the window may itself draw into a framebuffer object, as the headless backend does.
+    GLint window_fbo = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &window_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+    if (!done_)
+    {
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_);
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_);
+      glViewport(c.vpX(), c.vpY(), c.vpWidth(), c.vpHeight());
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    if (done_ < 1)
+    {
+      double end = std::min(1., done_ + double(budget_) / n);
+      bool timing = query_ && !query_pending_;
+      if (timing)
+        glBeginQuery(GL_TIME_ELAPSED, query_);
+      draw_range(done_, end);
+      if (timing)
+      {
+        glEndQuery(GL_TIME_ELAPSED);
+        query_pending_ = true;
+        query_points_ = (end - done_) * n;
+      }
+      done_ = end;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo_);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, window_fbo);
+    glBlitFramebuffer(c.vpX(), c.vpY(), width_, height_, c.vpX(), c.vpY(), width_, height_, GL_COLOR_BUFFER_BIT,
+                      GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, window_fbo);
+
+    CHECK_GLUT_ERROR
+    return done_ < 1;
+  }
+}
@@ -6,6 +6,8 @@
 #include <cstring>
 #include <cstdlib>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "ecto_gl.hpp"
 #include <stdexcept>
@@ -45,13 +47,23 @@ namespace ecto_gl
   }
 
   GLuint
-  createProgram(GLuint vertexShader, GLuint fragmentShader)
+  createProgram(GLuint vertexShader, GLuint fragmentShader, const std::vector<std::string>& feedback,
+                GLuint geometryShader)
   {
     GLuint program = glCreateProgram();
     if (!program)
       throw std::logic_error("Could not glCreateProgram");
     glAttachShader(program, vertexShader);
     glAttachShader(program, fragmentShader);
+    if (geometryShader)
+      glAttachShader(program, geometryShader);
+    if (!feedback.empty())
+    {
+      std::vector<const char*> names;
+      for (size_t i = 0; i < feedback.size(); i++)
+        names.push_back(feedback[i].c_str());
+      glTransformFeedbackVaryings(program, names.size(), names.data(), GL_INTERLEAVED_ATTRIBS);
+    }
     glLinkProgram(program);
     GLint linkStatus = GL_FALSE;
     glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
@@ -75,16 +87,20 @@ namespace ecto_gl
     return program;
   }
 
-  GlProgram::GlProgram(const char* vertexSource, const char* fragmentSource)
+  GlProgram::GlProgram(const char* vertexSource, const char* fragmentSource, const std::vector<std::string>& feedback,
+                       const char* geometrySource)
       :
         vertexShader(loadShader(GL_VERTEX_SHADER, vertexSource)),
         fragmentShader(loadShader(GL_FRAGMENT_SHADER, fragmentSource)),
-        program(createProgram(vertexShader, fragmentShader))
+        geometryShader(geometrySource ? loadShader(GL_GEOMETRY_SHADER, geometrySource) : 0),
+        program(createProgram(vertexShader, fragmentShader, feedback, geometryShader))
   {
   }
   GlProgram::~GlProgram()
   {
     glDeleteProgram(program);
+    if (geometryShader)
+      glDeleteShader(geometryShader);
     glDeleteShader(fragmentShader);
     glDeleteShader(vertexShader);
   }